@@ -0,0 +1,145 @@
+/*
+ * Memory vs. latency benchmark of the shared-stack threads.
+ *
+ * A ring of threads passes a token: every thread descends to a given stack
+ * depth, resumes the next thread and blocks itself, so every hop is one
+ * context switch. The benchmark reports the heap used by the threads and the
+ * average time of a hop, once with dedicated stacks and once with the shared
+ * stack.
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++17 -O2 -I. -DMAX_THREAD_NUM=100001 benchmarks/sharedStackBenchmark.cpp uthreads.cpp \
+ *       -o sharedStackBenchmark
+ * Usage:
+ *   ./sharedStackBenchmark <dedicated|shared> [threads] [depth] [rounds]
+ * e.g. ./sharedStackBenchmark shared 100000 8 20. The number of threads is
+ * limited by MAX_THREAD_NUM, and in the dedicated mode the depth is limited by
+ * STACK_SIZE (about 60 bytes of stack per level on top of FRAME_SIZE).
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <malloc.h>
+#include "uthreads.h"
+
+#define LONG_QUANTUM_USECS 999999 /* the ring switches by itself */
+#define FRAME_SIZE 64 /* bytes used by every level of the descent */
+
+int gThreadsNum = 64;
+int gDepth = 8;
+int gRounds = 2000;
+int gRingTids[MAX_THREAD_NUM];
+int gRingIdxOfTid[MAX_THREAD_NUM]; // the place of every thread in the ring
+size_t gHeapOfLiveRing = 0; // heap in use while all the threads hold a stack
+uthread_waitgroup_t gStarted, gFinished;
+
+/**
+ * @return the bytes currently allocated on the heap
+ */
+size_t getHeapInUse()
+{
+    return mallinfo2().uordblks;
+}
+
+/**
+ * @return monotonic time in nanoseconds
+ */
+long long getNanos()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/**
+ * uses depth frames of the stack and passes the token at the deepest one
+ * @param ringIdx index of the calling thread in the ring
+ * @param depth remaining frames
+ * @param isFirstRound true in the first round of the ring
+ * @param isLastRound true if the thread should not wait for the token again
+ */
+void passToken(int ringIdx, int depth, bool isFirstRound, bool isLastRound)
+{
+    volatile char frame[FRAME_SIZE];
+    memset((char *)frame, depth, FRAME_SIZE);
+    if (depth > 0)
+    {
+        passToken(ringIdx, depth - 1, isFirstRound, isLastRound);
+        return;
+    }
+    // all the other threads were switched out at their deepest frame
+    if (isFirstRound && ringIdx == gThreadsNum - 1)
+        gHeapOfLiveRing = getHeapInUse();
+    // the token is not passed back to the first thread after it finished
+    if (!isLastRound || ringIdx != gThreadsNum - 1)
+        uthread_resume(gRingTids[(ringIdx + 1) % gThreadsNum]);
+    if (!isLastRound)
+        uthread_block(uthread_get_tid());
+}
+
+/**
+ * entry point of the threads of the ring
+ */
+void ringThread()
+{
+    int ringIdx = gRingIdxOfTid[uthread_get_tid()];
+    uthread_waitgroup_done(&gStarted);
+    uthread_block(uthread_get_tid());
+    for (int round = 0; round < gRounds; ++round)
+        passToken(ringIdx, gDepth, round == 0, round == gRounds - 1);
+    uthread_waitgroup_done(&gFinished);
+    uthread_terminate(uthread_get_tid());
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || (strcmp(argv[1], "dedicated") != 0 && strcmp(argv[1], "shared") != 0))
+    {
+        fprintf(stderr, "usage: %s <dedicated|shared> [threads] [depth] [rounds]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    bool isShared = strcmp(argv[1], "shared") == 0;
+    if (argc > 2)
+        gThreadsNum = atoi(argv[2]);
+    if (argc > 3)
+        gDepth = atoi(argv[3]);
+    if (argc > 4)
+        gRounds = atoi(argv[4]);
+    if (gThreadsNum < 2 || gThreadsNum >= MAX_THREAD_NUM || gDepth < 0 || gRounds <= 0)
+    {
+        fprintf(stderr, "threads should be in [2, %d), depth non-negative, rounds positive\n", MAX_THREAD_NUM);
+        return EXIT_FAILURE;
+    }
+
+    uthread_init(LONG_QUANTUM_USECS);
+    uthread_waitgroup_init(&gStarted);
+    uthread_waitgroup_init(&gFinished);
+    uthread_waitgroup_add(&gStarted, gThreadsNum);
+    uthread_waitgroup_add(&gFinished, gThreadsNum);
+    // the first shared spawn also allocates the shared stack and the context
+    // which copies the stacks, so the heap is sampled after the first thread
+    // and the remaining threads are measured in both modes
+    size_t heapBefore = 0;
+    for (int i = 0; i < gThreadsNum; ++i)
+    {
+        gRingTids[i] = isShared ? uthread_spawn_shared(ringThread) : uthread_spawn(ringThread);
+        gRingIdxOfTid[gRingTids[i]] = i;
+        if (i == 0)
+            heapBefore = getHeapInUse();
+    }
+    uthread_waitgroup_wait(&gStarted); // all the threads wait for the token
+
+    long long start = getNanos();
+    uthread_resume(gRingTids[0]);
+    uthread_waitgroup_wait(&gFinished);
+    long long elapsed = getNanos() - start;
+
+    long long hops = (long long)gThreadsNum * gRounds;
+    printf("mode=%s threads=%d depth=%d rounds=%d\n", argv[1], gThreadsNum, gDepth, gRounds);
+    printf("ns per switch: %.1f\n", (double)elapsed / hops);
+    printf("heap per live thread: %zu bytes\n", (gHeapOfLiveRing - heapBefore) / (gThreadsNum - 1));
+    printf("shared stack: %d bytes\n", isShared ? SHARED_STACK_SIZE : 0);
+    uthread_terminate(0);
+}
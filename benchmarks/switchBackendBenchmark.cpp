@@ -0,0 +1,101 @@
+/*
+ * Context switch benchmark of the switch backends of uthread::runtime.
+ *
+ * The main thread and one spawned thread preempt each other in a loop, with no
+ * timer and no signal handler, so every preempt() is one context switch. The
+ * benchmark reports the average time of a switch and the size of a thread,
+ * once with signalMaskBackend (sigsetjmp/siglongjmp, a sigprocmask system call
+ * on every save and jump) and once with plainBackend (_setjmp/_longjmp).
+ *
+ * Build (from the repository root):
+ *   g++ -std=c++17 -O2 -I. benchmarks/switchBackendBenchmark.cpp -o switchBackendBenchmark
+ * Usage:
+ *   ./switchBackendBenchmark [switches]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include "uthreadRuntime.h"
+
+#define DEFAULT_SWITCHES 2000000
+
+/**
+ * the smallest runtime which switches with Backend
+ */
+template <class Backend>
+struct benchmarkConfig : uthread::defaultConfig
+{
+    static constexpr int maxThreads = 2;
+    static constexpr bool isStatsEnabled = false;
+    typedef Backend switchBackend;
+};
+
+template <class Backend>
+uthread::runtime<benchmarkConfig<Backend>> gRuntime;
+
+/**
+ * @return monotonic time in nanoseconds
+ */
+long long getNanos()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/**
+ * entry point of the spawned thread: gives the quantum back to the main thread
+ */
+template <class Backend>
+void switchingThread()
+{
+    for (;;)
+        gRuntime<Backend>.preempt();
+}
+
+/**
+ * @param switches the number of context switches to time
+ * @return the average time of a switch in nanoseconds
+ */
+template <class Backend>
+double measureSwitch(long long switches)
+{
+    auto &runtime = gRuntime<Backend>;
+    runtime.init();
+    int tid = runtime.spawn(&switchingThread<Backend>);
+    runtime.preempt(); // the spawned thread is started outside of the timing
+    long long rounds = switches / 2; // a round switches to the thread and back
+    long long start = getNanos();
+    for (long long round = 0; round < rounds; ++round)
+        runtime.preempt();
+    long long elapsed = getNanos() - start;
+    runtime.terminate(runtime.get(tid));
+    runtime.destroyAll();
+    return (double)elapsed / (rounds * 2);
+}
+
+/**
+ * times one backend and prints its results
+ */
+template <class Backend>
+void reportBackend(const char *name, long long switches)
+{
+    double nanos = measureSwitch<Backend>(switches);
+    printf("%s: %.1f ns per switch, %zu bytes per thread\n", name, nanos,
+           sizeof(typename uthread::runtime<benchmarkConfig<Backend>>::thread));
+}
+
+int main(int argc, char *argv[])
+{
+    long long switches = (argc > 1) ? atoll(argv[1]) : DEFAULT_SWITCHES;
+    if (switches < 2)
+    {
+        fprintf(stderr, "usage: %s [switches], at least 2 switches\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    printf("switches=%lld\n", switches);
+    reportBackend<uthread::signalMaskBackend>("signalMaskBackend", switches);
+    reportBackend<uthread::plainBackend>("plainBackend", switches);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,87 @@
+#ifndef EX2_UTHREADLOCAL_H
+#define EX2_UTHREADLOCAL_H
+
+#include <cstdio>
+#include <cstdlib>
+#include "uthreads.h"
+
+namespace uthread
+{
+
+/**
+ * a variable with a separate instance of T for every thread of the library
+ * (thread_local doesn't work for them, they all share one kernel thread).
+ * the instance of a thread is created on its first access and is deleted when
+ * the thread is terminated, so the destructor of T must not call functions of
+ * the thread library
+ */
+template <typename T>
+class local
+{
+private:
+    int key;
+
+    static void destroy(void *value)
+    {
+        delete static_cast<T *>(value);
+    }
+
+public:
+    local() : key(uthread_key_create(&destroy))
+    {
+    }
+
+    /**
+     * deletes the key; instances of threads which are still alive are not deleted
+     */
+    ~local()
+    {
+        if (key != -1)
+            uthread_key_delete(key);
+    }
+
+    local(const local &) = delete;
+    local &operator=(const local &) = delete;
+
+    /**
+     * @return false if no key was available for the variable (MAX_KEY_NUM)
+     */
+    bool isValid() const
+    {
+        return key != -1;
+    }
+
+    /**
+     * @return the instance of the calling thread. the process is aborted if
+     * the variable has no key (see isValid), since no instance could be kept
+     */
+    T &get()
+    {
+        if (!isValid())
+        {
+            fprintf(stderr, "thread library error: thread-local variable without a key\n");
+            abort();
+        }
+        auto *value = static_cast<T *>(uthread_getspecific(key));
+        if (value == nullptr)
+        {
+            value = new T();
+            uthread_setspecific(key, value);
+        }
+        return *value;
+    }
+
+    T &operator*()
+    {
+        return get();
+    }
+
+    T *operator->()
+    {
+        return &get();
+    }
+};
+
+}
+
+#endif
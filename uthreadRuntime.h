@@ -0,0 +1,1048 @@
+#ifndef EX2_UTHREADRUNTIME_H
+#define EX2_UTHREADRUNTIME_H
+
+#include <csetjmp>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "uthreads.h"
+
+/*
+ * The core of the thread library as a header-only class template: the thread
+ * table, the READY queue, blocking and the context switch. Every feature is
+ * chosen by a template parameter (see defaultConfig), so a disabled feature
+ * leaves no code in the switch and spawn paths and no data in the threads, and
+ * these paths are inlined into their callers. The runtime knows nothing about timers and signals: its
+ * functions must be called with the preemption signal blocked, and the
+ * embedding preempts the running thread by calling preempt(). uthreads.cpp is
+ * such an embedding, of the C API. Requires C++17.
+ */
+
+namespace uthread
+{
+
+enum threadState
+{
+    READY,
+    RUNNING,
+    BLOCKED
+};
+
+/**
+ * reasons of a BLOCKED thread, it becomes READY when no reason is left
+ */
+enum blockReason
+{
+    BLOCKED_BY_USER = 1, // until it is resumed
+    BLOCKED_BY_SYNC = 2, // until the thread it syncs with terminates
+    BLOCKED_BY_WAIT = 4 // until the embedding unblocks it (e.g. wait groups)
+};
+
+namespace detail
+{
+
+#ifdef __x86_64__
+/* code for 64 bit Intel arch */
+
+typedef unsigned long address_t;
+const int JB_SP = 6;
+const int JB_PC = 7;
+
+/* A translation is required when using an address of a variable.
+   Use this as a black box in your code. */
+inline address_t translate_address(address_t addr)
+{
+    address_t ret;
+    asm volatile("xor    %%fs:0x30,%0\n"
+            "rol    $0x11,%0\n"
+    : "=g" (ret)
+    : "0" (addr));
+    return ret;
+}
+
+#else
+/* code for 32 bit Intel arch */
+
+typedef unsigned int address_t;
+const int JB_SP = 4;
+const int JB_PC = 5;
+
+/* A translation is required when using an address of a variable.
+   Use this as a black box in your code. */
+inline address_t translate_address(address_t addr)
+{
+    address_t ret;
+    asm volatile("xor    %%gs:0x18,%0\n"
+		"rol    $0x9,%0\n"
+                 : "=g" (ret)
+                 : "0" (addr));
+    return ret;
+}
+
+#endif
+
+/**
+ * points a saved context to the top of a stack and to an entry function
+ * @param env the context
+ * @param sp the initial stack pointer
+ * @param pc the entry function
+ */
+inline void setContextEntry(__jmp_buf_tag *env, char *sp, void (*pc)(void))
+{
+    (env->__jmpbuf)[JB_SP] = translate_address((address_t)sp);
+    (env->__jmpbuf)[JB_PC] = translate_address((address_t)pc);
+}
+
+/**
+ * a counter which doesn't exist when the statistics are disabled
+ */
+template <bool IsEnabled>
+struct counter
+{
+    int value = 0;
+
+    void increment()
+    {
+        ++value;
+    }
+
+    int get() const
+    {
+        return value;
+    }
+};
+
+template <>
+struct counter<false>
+{
+    void increment()
+    {
+    }
+};
+
+/**
+ * an intrusive FIFO of READY threads, linked by their readyPrev/readyNext
+ */
+template <class Thread>
+class readyList
+{
+private:
+    Thread *head = nullptr;
+    Thread *tail = nullptr;
+
+public:
+    bool empty() const
+    {
+        return head == nullptr;
+    }
+
+    void push(Thread *thread)
+    {
+        thread->readyNext = nullptr;
+        thread->readyPrev = tail;
+        if (tail != nullptr)
+            tail->readyNext = thread;
+        else
+            head = thread;
+        tail = thread;
+    }
+
+    Thread *pop()
+    {
+        Thread *thread = head;
+        head = thread->readyNext;
+        if (head != nullptr)
+            head->readyPrev = nullptr;
+        else
+            tail = nullptr;
+        return thread;
+    }
+
+    void remove(Thread *thread)
+    {
+        if (thread->readyPrev != nullptr)
+            thread->readyPrev->readyNext = thread->readyNext;
+        else
+            head = thread->readyNext;
+        if (thread->readyNext != nullptr)
+            thread->readyNext->readyPrev = thread->readyPrev;
+        else
+            tail = thread->readyPrev;
+    }
+};
+
+}
+
+/*
+ * Context switch backends. A backend saves the context of the switched out
+ * thread and jumps to a saved context.
+ */
+
+/**
+ * sigsetjmp/siglongjmp: every switch also saves and restores the signal mask
+ * of the thread (a system call each)
+ */
+struct signalMaskBackend
+{
+    typedef sigjmp_buf context;
+
+    /**
+     * @param isMasked true if all the signals should be blocked in the context,
+     * otherwise it keeps the mask of the caller. the runtime is called with the
+     * preemption signal blocked, so no signal is handled between the jump to a
+     * new thread and hooks::onThreadStart
+     */
+    static void init(context &env, char *sp, void (*pc)(void), bool isMasked)
+    {
+        sigsetjmp(env, 1);
+        detail::setContextEntry(env, sp, pc);
+        if (isMasked)
+            sigfillset(&env->__saved_mask);
+    }
+
+    /**
+     * saves the context and calls jump, which must not return. returns when
+     * the context is jumped to
+     */
+    template <class Jump>
+    static void save(context &env, Jump jump)
+    {
+        if (sigsetjmp(env, 1) == 0)
+            jump();
+    }
+
+    [[noreturn]] static void jump(context &env)
+    {
+        siglongjmp(env, 1);
+    }
+};
+
+/**
+ * _setjmp/_longjmp: no system call on a switch, the signal mask is not part
+ * of the context. the embedding must restore the mask wherever a thread
+ * continues (and in hooks::onThreadStart)
+ */
+struct plainBackend
+{
+    typedef jmp_buf context;
+
+    static void init(context &env, char *sp, void (*pc)(void), bool isMasked)
+    {
+        _setjmp(env);
+        detail::setContextEntry(env, sp, pc);
+    }
+
+    template <class Jump>
+    static void save(context &env, Jump jump)
+    {
+        if (_setjmp(env) == 0)
+            jump();
+    }
+
+    [[noreturn]] static void jump(context &env)
+    {
+        _longjmp(env, 1);
+    }
+};
+
+/*
+ * Stack policies.
+ */
+
+/**
+ * every thread has its own heap stack of StackSize bytes
+ */
+template <size_t StackSize>
+struct dedicatedStack
+{
+    static constexpr size_t stackSize = StackSize;
+    static constexpr size_t sharedStackSize = 0;
+    static constexpr bool isSharingSupported = false;
+
+    struct threadData
+    {
+    };
+
+    /**
+     * data of the policy in the runtime
+     */
+    template <class Thread>
+    struct runtimeData
+    {
+    };
+};
+
+/**
+ * like dedicatedStack, and threads spawned by spawnShared run on one stack of
+ * SharedStackSize bytes: only the live part of the stack of a switched out
+ * thread is kept, in a heap buffer
+ */
+template <size_t StackSize, size_t SharedStackSize>
+struct sharedStack
+{
+    static constexpr size_t stackSize = StackSize;
+    static constexpr size_t sharedStackSize = SharedStackSize;
+    static constexpr bool isSharingSupported = true;
+
+    struct threadData
+    {
+        bool isShared = false; // runs on the shared stack
+        char *savedStack = nullptr; // live part of the shared stack while switched out
+        size_t savedStackSize = 0, savedStackCapacity = 0;
+
+        ~threadData()
+        {
+            delete[] savedStack;
+        }
+    };
+
+    template <class Thread>
+    struct runtimeData
+    {
+        char *base = nullptr; // the shared stack
+        Thread *owner = nullptr; // the thread whose live stack is on the shared stack
+        char *ownerSp = nullptr; // lowest live address of the owner while switched out
+        // context (outside of the shared stack) which swaps the contents of the shared stack:
+        Thread *copyContext = nullptr;
+    };
+};
+
+/*
+ * Scheduler policies. A policy has the per-thread data it needs, and a queue
+ * of the READY threads.
+ */
+
+/**
+ * round robin: the READY threads run in the order they became READY
+ */
+struct roundRobin
+{
+    struct threadData
+    {
+    };
+
+    template <class Thread>
+    class queue
+    {
+    private:
+        detail::readyList<Thread> threads;
+
+    public:
+        bool empty() const
+        {
+            return threads.empty();
+        }
+
+        void push(Thread *thread)
+        {
+            threads.push(thread);
+        }
+
+        Thread *pop()
+        {
+            return threads.pop();
+        }
+
+        void remove(Thread *thread)
+        {
+            threads.remove(thread);
+        }
+
+        void onQuantumStart(Thread &thread)
+        {
+        }
+    };
+};
+
+/**
+ * weighted groups of threads: the quantums are divided between the groups
+ * which have READY threads by stride scheduling, and inside a group the
+ * threads run by round robin. group 0 always exists, with DefaultWeight
+ */
+template <int MaxGroups, int DefaultWeight = 1>
+struct strideGroups
+{
+    static_assert(MaxGroups > 0 && MaxGroups <= 64, "the groups are kept in a 64 bit mask");
+
+    static constexpr unsigned long long STRIDE_BASE = 1 << 20; // pass distance of a weight 1 group per quantum
+
+    struct threadData
+    {
+        int group = 0;
+    };
+
+    template <class Thread>
+    class queue
+    {
+    private:
+        struct threadGroup
+        {
+            bool isUsed;
+            int weight;
+            int quantum; // quantums started by threads of the group
+            unsigned long long pass; // stride scheduling virtual time of the group
+            detail::readyList<Thread> threads;
+        };
+
+        threadGroup groups[MaxGroups] = {{true, DefaultWeight, 0, 0, {}}};
+        uint64_t readyGroups = 0; // bit per group with READY threads
+        unsigned long long globalPass = 0; // pass of the last scheduled group
+
+    public:
+        bool empty() const
+        {
+            return readyGroups == 0;
+        }
+
+        void push(Thread *thread)
+        {
+            int group = thread->scheduling.group;
+            groups[group].threads.push(thread);
+            readyGroups |= (uint64_t)1 << group;
+        }
+
+        /**
+         * @return the first thread of the group with the minimal pass
+         */
+        Thread *pop()
+        {
+            int chosenGroup = -1;
+            for (uint64_t mask = readyGroups; mask != 0; mask &= mask - 1)
+            {
+                int group = __builtin_ctzll(mask);
+                // a group which had no ready threads doesn't keep the credit of that time
+                if (groups[group].pass < globalPass)
+                    groups[group].pass = globalPass;
+                if (chosenGroup == -1 || groups[group].pass < groups[chosenGroup].pass)
+                    chosenGroup = group;
+            }
+            Thread *thread = groups[chosenGroup].threads.pop();
+            if (groups[chosenGroup].threads.empty())
+                readyGroups &= ~((uint64_t)1 << chosenGroup);
+            return thread;
+        }
+
+        void remove(Thread *thread)
+        {
+            int group = thread->scheduling.group;
+            groups[group].threads.remove(thread);
+            if (groups[group].threads.empty())
+                readyGroups &= ~((uint64_t)1 << group);
+        }
+
+        /**
+         * charges the new quantum of the thread to its group
+         */
+        void onQuantumStart(Thread &thread)
+        {
+            threadGroup &group = groups[thread.scheduling.group];
+            globalPass = group.pass;
+            group.pass += STRIDE_BASE / group.weight;
+            ++group.quantum;
+        }
+
+        /**
+         * @return the ID of the created group, -1 if there are MaxGroups groups
+         */
+        int createGroup(int weight)
+        {
+            for (int i = 0; i < MaxGroups; ++i)
+            {
+                if (!groups[i].isUsed)
+                {
+                    groups[i].isUsed = true;
+                    groups[i].weight = weight;
+                    groups[i].quantum = 0;
+                    groups[i].pass = globalPass;
+                    return i;
+                }
+            }
+            return -1;
+        }
+
+        bool isGroup(int group) const
+        {
+            return group >= 0 && group < MaxGroups && groups[group].isUsed;
+        }
+
+        /**
+         * moves a thread to an existing group
+         */
+        void attach(Thread &thread, int group)
+        {
+            bool isQueued = (thread.state == READY);
+            if (isQueued)
+                remove(&thread);
+            thread.scheduling.group = group;
+            if (isQueued)
+                push(&thread);
+        }
+
+        int getGroupQuantums(int group) const
+        {
+            return groups[group].quantum;
+        }
+    };
+};
+
+/**
+ * hooks of an embedding which needs none. every hook is called with the
+ * preemption signal blocked
+ */
+struct noHooks
+{
+    /**
+     * a thread became READY
+     */
+    template <class Runtime>
+    static void onReady(Runtime &runtime)
+    {
+    }
+
+    /**
+     * a scheduling decision is about to be made
+     */
+    template <class Runtime>
+    static void onSchedule(Runtime &runtime)
+    {
+    }
+
+    /**
+     * no thread is READY: the hook should wait until an external event makes
+     * one READY. without such events the threads are deadlocked
+     */
+    template <class Runtime>
+    static void onIdle(Runtime &runtime)
+    {
+        abort();
+    }
+
+    /**
+     * the chosen thread became the running thread
+     */
+    template <class Runtime>
+    static void onQuantumStart(Runtime &runtime)
+    {
+    }
+
+    /**
+     * the running thread gives up the rest of its quantum (it blocks or
+     * terminates itself)
+     */
+    template <class Runtime>
+    static void onYield(Runtime &runtime)
+    {
+    }
+
+    /**
+     * a thread is about to be terminated
+     */
+    template <class Runtime, class Thread>
+    static void onTerminate(Runtime &runtime, Thread &thread)
+    {
+    }
+
+    /**
+     * the first code of every spawned thread, before its entry point. the
+     * thread starts with the preemption signal blocked (the mask of the code
+     * which spawned it), the hook should unblock it
+     */
+    template <class Runtime>
+    static void onThreadStart(Runtime &runtime)
+    {
+    }
+};
+
+/**
+ * the configuration of a runtime: a runtime<Config> takes each of these
+ * members from its Config, so a configuration usually derives from this one
+ * and replaces some of them
+ */
+struct defaultConfig
+{
+    static constexpr int maxThreads = MAX_THREAD_NUM; // including the main thread
+    typedef dedicatedStack<STACK_SIZE> stackPolicy;
+    typedef roundRobin schedulerPolicy;
+    static constexpr bool isStatsEnabled = true; // quantum counters
+    typedef signalMaskBackend switchBackend;
+    typedef noHooks hooks;
+
+    /**
+     * data of the embedding in every thread
+     */
+    struct threadData
+    {
+    };
+};
+
+/**
+ * the threads of one kernel thread. the main thread (tid 0) is the code which
+ * called init(). only one runtime of a Config may exist, since the entry of
+ * the spawned threads finds it through a static pointer
+ */
+template <class Config>
+class runtime
+{
+public:
+    typedef typename Config::stackPolicy stackPolicy;
+    typedef typename Config::schedulerPolicy schedulerPolicy;
+    typedef typename Config::switchBackend switchBackend;
+    typedef typename Config::hooks hooks;
+    static constexpr int maxThreads = Config::maxThreads;
+    static constexpr bool isStatsEnabled = Config::isStatsEnabled;
+
+    /**
+     * a thread of the runtime
+     */
+    struct thread
+    {
+        int tid;
+        threadState state = READY;
+        int blockReasons = 0; // blockReason bits
+        int syncedTid = -1; // the thread it syncs with
+        void (*func)(void);
+        char *stack = nullptr;
+        size_t stackSize = 0;
+        thread *readyPrev = nullptr;
+        thread *readyNext = nullptr;
+        // the data of a disabled feature takes no space:
+        [[no_unique_address]] detail::counter<isStatsEnabled> quantums;
+        [[no_unique_address]] typename schedulerPolicy::threadData scheduling;
+        [[no_unique_address]] typename stackPolicy::threadData stacking;
+        [[no_unique_address]] typename Config::threadData data;
+        typename switchBackend::context env;
+
+        thread(int tid, void (*func)(void)) : tid(tid), func(func)
+        {
+        }
+
+        ~thread()
+        {
+            if (!isOnSharedStack(*this))
+                delete[] stack;
+        }
+
+        thread(const thread &) = delete;
+        thread &operator=(const thread &) = delete;
+    };
+
+    typedef typename schedulerPolicy::template queue<thread> schedulerQueue;
+
+private:
+    thread *threads[maxThreads] = {nullptr}; // by tid
+    int threadsNum = 0;
+    int lowestFreeTid = 0; // all the IDs below it are used
+    int syncingNum = 0; // threads which wait in sync
+    thread *running = nullptr;
+    // a thread which terminated itself, deleted only after the runtime left its stack:
+    thread *zombie = nullptr;
+    schedulerQueue readyQueue;
+    [[no_unique_address]] detail::counter<isStatsEnabled> totalQuantums;
+    [[no_unique_address]] typename stackPolicy::template runtimeData<thread> stacking;
+
+    static inline runtime *instance = nullptr;
+
+    static bool isOnSharedStack(const thread &checkedThread)
+    {
+        if constexpr (stackPolicy::isSharingSupported)
+            return checkedThread.stacking.isShared;
+        else
+            return false;
+    }
+
+    /**
+     * entry point of the spawned threads
+     */
+    static void threadEntry()
+    {
+        hooks::onThreadStart(*instance);
+        instance->running->func();
+    }
+
+    /**
+     * entry point of the stack copy context: saves the live part of the shared
+     * stack of its owner and restores the stack of the running thread, while
+     * no thread runs on the shared stack
+     */
+    static void switchSharedStack()
+    {
+        runtime &self = *instance;
+        if (self.stacking.owner != nullptr)
+            saveStack(*self.stacking.owner, self.stacking.ownerSp);
+        restoreStack(*self.running);
+        self.stacking.owner = self.running;
+        switchBackend::jump(self.running->env);
+    }
+
+    static void saveStack(thread &owner, const char *sp)
+    {
+        auto &saved = owner.stacking;
+        saved.savedStackSize = owner.stack + owner.stackSize - sp;
+        // the buffer follows the size of the live part of the stack
+        if (saved.savedStackSize > saved.savedStackCapacity ||
+            saved.savedStackSize < saved.savedStackCapacity / 2)
+        {
+            delete[] saved.savedStack;
+            saved.savedStack = new char[saved.savedStackSize];
+            saved.savedStackCapacity = saved.savedStackSize;
+        }
+        memcpy(saved.savedStack, sp, saved.savedStackSize);
+    }
+
+    static void restoreStack(thread &owner)
+    {
+        auto &saved = owner.stacking;
+        if (saved.savedStackSize > 0)
+            memcpy(owner.stack + owner.stackSize - saved.savedStackSize, saved.savedStack, saved.savedStackSize);
+        else // a new thread: no return address above its entry point
+            *(detail::address_t *)(owner.stack + owner.stackSize - sizeof(detail::address_t)) = 0;
+    }
+
+    /**
+     * creates a new READY thread with the lowest free ID (the runtime
+     * shouldn't be full)
+     * @param f entry point of the thread
+     * @param isShared true if the thread runs on the shared stack
+     * @return the ID of the created thread
+     */
+    int addThread(void (*f)(void), bool isShared)
+    {
+        deleteZombie();
+        int tid = lowestFreeTid;
+        while (threads[tid] != nullptr)
+            ++tid;
+        auto *newThread = new thread(tid, f);
+        initStack(*newThread, isShared);
+        threads[tid] = newThread;
+        lowestFreeTid = tid + 1;
+        ++threadsNum;
+        makeReady(newThread);
+        return tid;
+    }
+
+    /**
+     * gives a new thread a stack and points its context to threadEntry
+     */
+    void initStack(thread &newThread, bool isShared)
+    {
+        if constexpr (stackPolicy::isSharingSupported)
+        {
+            if (isShared)
+            {
+                newThread.stack = stacking.base;
+                newThread.stackSize = stackPolicy::sharedStackSize;
+                newThread.stacking.isShared = true;
+            }
+        }
+        if (!isOnSharedStack(newThread))
+        {
+            newThread.stack = new char[stackPolicy::stackSize];
+            newThread.stackSize = stackPolicy::stackSize;
+        }
+        char *sp = newThread.stack + newThread.stackSize - sizeof(detail::address_t);
+        if (!isOnSharedStack(newThread)) // the live part of the shared stack may belong to another thread
+            *(detail::address_t *)sp = 0;
+        switchBackend::init(newThread.env, sp, &threadEntry, false);
+    }
+
+    void deleteZombie()
+    {
+        delete zombie;
+        zombie = nullptr;
+    }
+
+    void makeReady(thread *readyThread)
+    {
+        readyThread->state = READY;
+        readyQueue.push(readyThread);
+        hooks::onReady(*this);
+    }
+
+    void startQuantum(thread *startedThread)
+    {
+        startedThread->state = RUNNING;
+        startedThread->quantums.increment();
+        totalQuantums.increment();
+        readyQueue.onQuantumStart(*startedThread);
+    }
+
+    /**
+     * removes the next thread from the READY queue and makes it the running thread
+     */
+    void runNext()
+    {
+        hooks::onSchedule(*this);
+        while (readyQueue.empty())
+            hooks::onIdle(*this);
+        running = readyQueue.pop();
+        startQuantum(running);
+        hooks::onQuantumStart(*this);
+    }
+
+    /**
+     * jumps to the running thread. a shared-stack thread which doesn't own the
+     * shared stack is reached through the stack copy context
+     */
+    [[noreturn]] __attribute__((noinline)) void jumpToRunning()
+    {
+        if constexpr (stackPolicy::isSharingSupported)
+        {
+            char stackMarker;
+            // only the owner runs on the shared stack, and all of its live part
+            // is above the frame of this function
+            if (&stackMarker >= stacking.base && &stackMarker < stacking.base + stackPolicy::sharedStackSize)
+                stacking.ownerSp = &stackMarker;
+            if (isOnSharedStack(*running) && stacking.owner != running)
+                switchBackend::jump(stacking.copyContext->env);
+        }
+        switchBackend::jump(running->env);
+    }
+
+    /**
+     * switches from the thread which was running (already READY or BLOCKED) to
+     * the next thread. returns when the thread runs again
+     */
+    void switchFrom(thread *previous)
+    {
+        runNext();
+        if (running == previous)
+            return;
+        switchBackend::save(previous->env, [this] { jumpToRunning(); });
+    }
+
+    void releaseSynced(int tid)
+    {
+        // most terminations have no syncing thread to look for
+        for (int i = 0; i < maxThreads && syncingNum > 0; ++i)
+        {
+            thread *syncedThread = threads[i];
+            if (syncedThread != nullptr && syncedThread->syncedTid == tid)
+            {
+                syncedThread->syncedTid = -1;
+                --syncingNum;
+                unblock(syncedThread, BLOCKED_BY_SYNC);
+            }
+        }
+    }
+
+public:
+    runtime() = default;
+    runtime(const runtime &) = delete;
+    runtime &operator=(const runtime &) = delete;
+
+    ~runtime()
+    {
+        destroyAll();
+        if (instance == this)
+            instance = nullptr;
+    }
+
+    /**
+     * makes the calling code the main thread, in its first quantum
+     */
+    void init()
+    {
+        instance = this;
+        threads[0] = new thread(0, nullptr);
+        threadsNum = 1;
+        lowestFreeTid = 1;
+        running = threads[0];
+        startQuantum(running);
+    }
+
+    /**
+     * deletes all the threads. if the calling code is a spawned thread, the
+     * stack it runs on is left to the exit of the process
+     */
+    void destroyAll()
+    {
+        thread *caller = (running != nullptr && running->tid != 0) ? running : nullptr;
+        deleteZombie();
+        if constexpr (stackPolicy::isSharingSupported)
+        {
+            delete stacking.copyContext;
+            stacking.copyContext = nullptr;
+        }
+        for (thread *&deletedThread : threads)
+        {
+            if (deletedThread != caller)
+                delete deletedThread;
+            deletedThread = nullptr;
+        }
+        threadsNum = 0;
+        lowestFreeTid = 0;
+        syncingNum = 0;
+        running = nullptr;
+        if constexpr (stackPolicy::isSharingSupported)
+        {
+            if (caller == nullptr || !isOnSharedStack(*caller))
+                delete[] stacking.base;
+            stacking.base = nullptr;
+            stacking.owner = nullptr;
+        }
+    }
+
+    bool isFull() const
+    {
+        return threadsNum == maxThreads;
+    }
+
+    bool isReadyEmpty() const
+    {
+        return readyQueue.empty();
+    }
+
+    /**
+     * @return the thread with ID tid, null if it doesn't exist
+     */
+    thread *get(int tid) const
+    {
+        return (tid >= 0 && tid < maxThreads) ? threads[tid] : nullptr;
+    }
+
+    thread *getRunning() const
+    {
+        return running;
+    }
+
+    schedulerQueue &scheduler()
+    {
+        return readyQueue;
+    }
+
+    int getTotalQuantums() const
+    {
+        static_assert(isStatsEnabled, "the statistics are disabled");
+        return totalQuantums.get();
+    }
+
+    static int getQuantums(const thread &countedThread)
+    {
+        static_assert(isStatsEnabled, "the statistics are disabled");
+        return countedThread.quantums.get();
+    }
+
+    /**
+     * creates a new READY thread with the lowest free ID (the runtime
+     * shouldn't be full)
+     * @param f entry point of the thread
+     * @return the ID of the created thread
+     */
+    int spawn(void (*f)(void))
+    {
+        return addThread(f, false);
+    }
+
+    /**
+     * like spawn, on the shared stack
+     */
+    int spawnShared(void (*f)(void))
+    {
+        static_assert(stackPolicy::isSharingSupported, "the stack policy has no shared stack");
+        if (stacking.copyContext == nullptr)
+        {
+            stacking.base = new char[stackPolicy::sharedStackSize];
+            stacking.copyContext = new thread(-1, nullptr);
+            stacking.copyContext->stack = new char[stackPolicy::stackSize];
+            stacking.copyContext->stackSize = stackPolicy::stackSize;
+            // no signal is handled on the small stack of the copy context
+            switchBackend::init(stacking.copyContext->env, stacking.copyContext->stack + stackPolicy::stackSize -
+                                sizeof(detail::address_t), &switchSharedStack, true);
+        }
+        return addThread(f, true);
+    }
+
+    /**
+     * terminates a thread which isn't the main thread. if it is the running
+     * thread, the function doesn't return
+     */
+    void terminate(thread *terminatedThread)
+    {
+        hooks::onTerminate(*this, *terminatedThread);
+        if constexpr (stackPolicy::isSharingSupported)
+        {
+            if (stacking.owner == terminatedThread) // its stack is not needed anymore
+                stacking.owner = nullptr;
+        }
+        if (terminatedThread->state == READY)
+            readyQueue.remove(terminatedThread);
+        threads[terminatedThread->tid] = nullptr;
+        --threadsNum;
+        if (terminatedThread->tid < lowestFreeTid)
+            lowestFreeTid = terminatedThread->tid;
+        if (terminatedThread->syncedTid != -1)
+            --syncingNum;
+        // the waiting threads are released first, they may be the only ones to run
+        releaseSynced(terminatedThread->tid);
+        if (terminatedThread != running)
+        {
+            delete terminatedThread;
+            return;
+        }
+        hooks::onYield(*this);
+        runNext();
+        // the thread still runs on its own stack, so it is deleted later
+        deleteZombie();
+        zombie = terminatedThread;
+        jumpToRunning();
+    }
+
+    /**
+     * adds a block reason to a thread. a READY thread leaves the READY queue,
+     * and the running thread switches to the next thread (the function returns
+     * when the thread runs again)
+     */
+    void block(thread *blockedThread, blockReason reason)
+    {
+        blockedThread->blockReasons |= reason;
+        if (blockedThread == running)
+        {
+            blockedThread->state = BLOCKED;
+            hooks::onYield(*this);
+            switchFrom(blockedThread);
+        }
+        else if (blockedThread->state == READY)
+        {
+            readyQueue.remove(blockedThread);
+            blockedThread->state = BLOCKED;
+        }
+    }
+
+    /**
+     * removes a block reason of a thread, which becomes READY when it has no
+     * reason left
+     */
+    void unblock(thread *blockedThread, blockReason reason)
+    {
+        blockedThread->blockReasons &= ~reason;
+        if (blockedThread->state == BLOCKED && blockedThread->blockReasons == 0)
+            makeReady(blockedThread);
+    }
+
+    /**
+     * blocks the running thread until the thread syncedThread terminates
+     */
+    void sync(thread *syncedThread)
+    {
+        running->syncedTid = syncedThread->tid;
+        ++syncingNum;
+        block(running, BLOCKED_BY_SYNC);
+    }
+
+    /**
+     * ends the quantum of the running thread, which goes to the end of the
+     * READY queue. returns when the thread runs again
+     */
+    void preempt()
+    {
+        thread *previous = running;
+        makeReady(previous);
+        switchFrom(previous);
+    }
+};
+
+}
+
+#endif
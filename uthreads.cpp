@@ -1,75 +1,222 @@
 #include <iostream>
 #include <vector>
 #include "uthreads.h"
-#include "myThread.h"
+#include "uthreadRuntime.h"
 #include <csignal>
 #include <sys/time.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <string>
+#include <map>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <ucontext.h>
 
 #define ERROR (-1)
 #define ERROR_LIB_MSG "thread library error: "
 #define ERROR_SYS_MSG "system error: "
-#define READY 0
-#define RUNNING 1
-#define BLOCKED 2
-#define EXPIRED_TIME 0
-#define BLOCKED_THREAD_ITSELF 1
+#define INBOX_MASK (INBOX_SIZE - 1)
+#define BUDGET_NOT_DRAWN (-1) /* the budget of the quantum is drawn on its first tick */
+#define BUDGET_DISARMED (-2) /* no preemption in deterministic mode */
+#define PROFILE_FOLD_STACK_SIZE (1024 * 1024) /* stack of the folding of the profiler samples */
+
+static_assert((INBOX_SIZE & INBOX_MASK) == 0, "INBOX_SIZE should be a power of 2");
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
 
 using std::cerr;
+using std::map;
+using std::string;
 using std::vector;
+using uthread::READY;
+using uthread::BLOCKED;
+using uthread::BLOCKED_BY_USER;
+using uthread::BLOCKED_BY_WAIT;
+
+/**
+ * data of the library in every thread, next to the data of the runtime
+ */
+struct libraryThreadData
+{
+    uthread_waitgroup_t *waitGroup = nullptr; // the wait group the thread waits on
+    // a heap copy of the threads it waits for in uthread_join_any (the array
+    // of the caller may be on a shared stack, which other threads overwrite)
+    int *joinTids = nullptr;
+    int joinTidsNum = 0;
+    int joinedTid = -1; // the thread which woke it from uthread_join_any
+    void *specific[MAX_KEY_NUM] = {nullptr}; // values of the thread-local storage keys
+
+    ~libraryThreadData()
+    {
+        delete[] joinTids;
+    }
+};
+
+struct libraryHooks;
+
+/**
+ * the runtime behind the C API: weighted groups, dedicated and shared stacks
+ */
+struct libraryConfig : uthread::defaultConfig
+{
+    typedef uthread::sharedStack<STACK_SIZE, SHARED_STACK_SIZE> stackPolicy;
+    typedef uthread::strideGroups<MAX_GROUP_NUM, DEFAULT_GROUP_WEIGHT> schedulerPolicy;
+    typedef libraryHooks hooks;
+    typedef libraryThreadData threadData;
+};
+
+typedef uthread::runtime<libraryConfig> libraryRuntime;
+typedef libraryRuntime::thread libraryThread;
+
+/**
+ * the timer, the inbox and the features of the C API around the scheduling
+ * decisions of the runtime
+ */
+struct libraryHooks : uthread::noHooks
+{
+    static void onReady(libraryRuntime &runtime);
+    static void onSchedule(libraryRuntime &runtime);
+    static void onIdle(libraryRuntime &runtime);
+    static void onQuantumStart(libraryRuntime &runtime);
+    static void onYield(libraryRuntime &runtime);
+    static void onTerminate(libraryRuntime &runtime, libraryThread &thread);
+    static void onThreadStart(libraryRuntime &runtime);
+};
+
+libraryRuntime gRuntime;
+
+/**
+ * a chunk of uthread_parallel_for which runs in its own thread
+ */
+struct parallelForTask
+{
+    void (*fn)(int, int);
+    int begin;
+    int end;
+    uthread_waitgroup_t *wg;
+};
+
+parallelForTask gParallelForTasks[MAX_THREAD_NUM]; // tasks of the worker threads by tid
+int gJoiningNum = 0; // threads which wait in uthread_join_any
+
+bool gIsKeyUsed[MAX_KEY_NUM] = {false}; // thread-local storage keys
+void (*gKeyDestructors[MAX_KEY_NUM])(void *) = {nullptr};
+
+bool isTickless = false; // disarm the timer while no other thread is ready
+// read by foreign kernel threads, which kick the scheduler if the timer is disarmed:
+std::atomic<bool> isTimerArmed(false);
+std::atomic<bool> isIdle(false); // the kernel thread sleeps until a thread is ready
+
+/**
+ * a request of a foreign kernel thread: a call of fn(arg), or a resume of tid if fn is null
+ */
+struct inboxMessage
+{
+    void (*fn)(void *);
+    void *arg;
+    int tid;
+};
+
+/**
+ * a place in the inbox, sequence tells whether it is free for the producers or
+ * full for the scheduler (a bounded multi-producer queue)
+ */
+struct inboxCell
+{
+    std::atomic<size_t> sequence;
+    inboxMessage message;
+};
+
+inboxCell gInbox[INBOX_SIZE];
+std::atomic<size_t> gInboxEnqueuePos(0);
+size_t gInboxDequeuePos = 0; // only the scheduler dequeues
+std::atomic<bool> isInboxSignaled(false); // the eventfd was written since the last drain
+int inboxEventFd = -1;
+pid_t schedulerKernelTid = 0; // the kernel thread which runs all the threads
+
+// deterministic mode: a virtual clock, advanced by uthread_tick, replaces the timer
+bool isDeterministic = false;
+long long virtualTime = 0;
+int quantumTicks = 0;
+int quantumTicksLeft = BUDGET_DISARMED; // budget of the current quantum
+unsigned long long scheduleRandomState = 0; // 0 - every quantum is quantumTicks long
+vector<int> gScheduleLog; // budgets of all the quantums so far
+vector<int> gReplaySchedule; // budgets to use instead of drawing them
+size_t gReplayPos = 0;
+
+/**
+ * a sample of the profiler: the running thread and its stack, leaf first
+ */
+struct profileSample
+{
+    int tid;
+    int depth;
+    void *frames[PROFILE_MAX_DEPTH];
+};
+
+bool isProfiling = false;
+timer_t profileTimer; // CPU time timer of the scheduler kernel thread for the samples
+profileSample *gProfileSamples = nullptr; // allocated when the profiler starts
+volatile int gProfileSamplesNum = 0;
+char *mainStackLow = nullptr, *mainStackHigh = nullptr; // the stack of the main thread
+
+/**
+ * the samples which uthread_profile_stop folds on a stack of its own, and the result
+ */
+struct profileFolding
+{
+    profileSample *samples;
+    int samplesNum;
+    int fd;
+    bool isWritten;
+};
 
-vector<myThread*> gReadyThreadsList; // ready threads as objects
-// all current threads as objects (without terminated):
-myThread* gCurrentThreadsList[MAX_THREAD_NUM] = {nullptr};
-// binary array - 1 tells that this idx is full by thread, 0 other:
-int envBinaryThreadPlaces[MAX_THREAD_NUM] = {0};
-int tidCounter = 0;
-myThread *runningThread = nullptr;
-int totalQuantum = 0;
-bool blockCalledFromSync = false;
+profileFolding gProfileFolding;
+// outside of the stack of the thread which stops the profiler, it may be small:
+ucontext_t profileCallerContext, profileFoldContext;
 
 struct sigaction sa;
-struct itimerval timer;
+timer_t quantumTimer; // CPU time timer of the scheduler kernel thread
+struct itimerspec timer;
+struct itimerspec disarmedTimer = {{0, 0}, {0, 0}};
 sigset_t set;
 
 /**
- * releases the synced threads
- * @param tid terminated tid
+ * stops the timer of the profiler, a sample which is still pending is dropped
  */
-void releaseSynced(int tid)
+void stopProfileTimer()
 {
-    for (auto& thread : gCurrentThreadsList)
-    {
-        if (thread == nullptr)
-            continue;
-        if (thread->getSyncedTid() == tid)
-        {
-            if (!thread->getIsBlockedNotBySynced())
-            {
-                thread->setState(READY);
-                thread->setSyncedTid(-1);
-                gReadyThreadsList.push_back(thread);
-            }
-        }
-    }
+    if (!isProfiling)
+        return;
+    timer_delete(profileTimer);
+    signal(SIGPROF, SIG_IGN);
+    isProfiling = false;
 }
 
 /**
- * delete all the threads
+ * delete all the threads (no sample may be taken on a deleted stack)
  */
 void deleteAllThreads()
 {
-    for (auto &thread : gCurrentThreadsList)
-    {
-        if (thread != nullptr)
-        {
-            delete thread;
-            thread = nullptr;
-        }
-    }
+    stopProfileTimer();
+    gRuntime.destroyAll();
 }
 
 /**
- * block signals
+ * block signals. only the signals of the library are blocked, so a handler of
+ * another signal may run in the middle of the library: such a handler wakes
+ * threads only through the inbox (uthread_resume_external)
  */
 void blockSignals()
 {
@@ -95,138 +242,343 @@ void unBlockSignals()
 }
 
 /**
- * responsible to valid if the tid exists
- * @return true if exists, false otherwise
+ * sets the quantum timer
+ * @param newTimer the new value of the timer
  */
-bool isExistTid(int tid)
+void setTimer(const struct itimerspec *newTimer)
+{
+    if (timer_settime(quantumTimer, 0, newTimer, nullptr))
+    {
+        cerr << ERROR_SYS_MSG << "timer_settime failed\n";
+        deleteAllThreads();
+        exit(ERROR);
+    }
+}
+
+/**
+ * starts a full quantum for the running thread
+ */
+void armTimer()
+{
+    if (isDeterministic)
+        quantumTicksLeft = BUDGET_NOT_DRAWN;
+    else
+        setTimer(&timer);
+    isTimerArmed = true;
+}
+
+/**
+ * stops the quantum timer (no preemption until it is armed again)
+ */
+void disarmTimer()
+{
+    if (isDeterministic)
+        quantumTicksLeft = BUDGET_DISARMED;
+    else
+        setTimer(&disarmedTimer);
+    isTimerArmed = false;
+}
+
+/**
+ * responsible to return the budget of a new quantum in deterministic mode: the
+ * next budget of the replayed schedule, or a pseudo random budget in
+ * [1, quantumTicks] (a fixed one if there is no seed). the budget is recorded
+ * @return the budget of the quantum in ticks
+ */
+int drawQuantumBudget()
+{
+    int budget = quantumTicks;
+    if (gReplayPos < gReplaySchedule.size())
+        budget = gReplaySchedule[gReplayPos++];
+    else if (scheduleRandomState != 0)
+    {
+        // xorshift64*
+        scheduleRandomState ^= scheduleRandomState >> 12;
+        scheduleRandomState ^= scheduleRandomState << 25;
+        scheduleRandomState ^= scheduleRandomState >> 27;
+        budget = 1 + (int)((scheduleRandomState * 2685821657736338717ULL >> 33) % quantumTicks);
+    }
+    gScheduleLog.push_back(budget);
+    return budget;
+}
+
+/**
+ * forgets the threads which a thread waits for in uthread_join_any
+ * @param thread the joining thread
+ */
+void stopJoining(libraryThread *thread)
+{
+    if (thread->data.joinTids == nullptr)
+        return;
+    delete[] thread->data.joinTids;
+    thread->data.joinTids = nullptr;
+    thread->data.joinTidsNum = 0;
+    --gJoiningNum;
+}
+
+/**
+ * wakes a thread which waits in a wait group or in uthread_join_any
+ * @param thread the waiting thread
+ */
+void wakeWaitingThread(libraryThread *thread)
+{
+    thread->data.waitGroup = nullptr;
+    stopJoining(thread);
+    gRuntime.unblock(thread, BLOCKED_BY_WAIT);
+}
+
+/**
+ * wakes the threads which wait in uthread_join_any for the terminated thread,
+ * and removes the terminated thread from the wait group it waits on
+ * @param terminatedThread the terminated thread
+ */
+void releaseJoined(libraryThread *terminatedThread)
 {
-    for (auto& thread : gCurrentThreadsList)
+    if (terminatedThread->data.waitGroup != nullptr)
+        terminatedThread->data.waitGroup->waiterTid = -1;
+    stopJoining(terminatedThread);
+    // most terminations have no joining thread to look for
+    for (int tid = 0; tid < MAX_THREAD_NUM && gJoiningNum > 0; ++tid)
     {
-        if (thread == nullptr)
+        libraryThread *thread = gRuntime.get(tid);
+        if (thread == nullptr || thread->data.joinTids == nullptr)
             continue;
-        if (thread->getTid() == tid)
-            return true;
+        for (int i = 0; i < thread->data.joinTidsNum; ++i)
+        {
+            if (thread->data.joinTids[i] == terminatedThread->tid)
+            {
+                thread->data.joinedTid = terminatedThread->tid;
+                wakeWaitingThread(thread);
+                break;
+            }
+        }
     }
-    return false;
 }
 
 /**
- * responsible to return the number of all current threads
- * @return the number of all current threads
+ * calls the destructors of the thread-local storage values of a thread
+ * @param thread the terminated thread
  */
-int getCurrentThreadsNumber()
+void destroySpecifics(libraryThread *thread)
 {
-    int result = 0;
-    for (int binaryThreadPlace : envBinaryThreadPlaces)
+    for (int key = 0; key < MAX_KEY_NUM; ++key)
     {
-        result += binaryThreadPlace;
+        void *value = thread->data.specific[key];
+        if (value == nullptr)
+            continue;
+        thread->data.specific[key] = nullptr;
+        if (gIsKeyUsed[key] && gKeyDestructors[key] != nullptr)
+            gKeyDestructors[key](value);
     }
-    return result;
 }
 
 /**
- * responsible to return the first free place in env array
- * @return the first free place in env array (if there is no free place - return -1)
+ * responsible to valid if the thread-local storage key exists
+ * @return true if exists, false otherwise
+ */
+bool isExistKey(int key)
+{
+    return key >= 0 && key < MAX_KEY_NUM && gIsKeyUsed[key];
+}
+
+/**
+ * responsible to valid if the tid exists
+ * @return true if exists, false otherwise
+ */
+bool isExistTid(int tid)
+{
+    return gRuntime.get(tid) != nullptr;
+}
+
+/**
+ * writes all the data to a file descriptor
+ * @param fd the file descriptor
+ * @param data the written data
+ * @return true on success, false otherwise
  */
-int getLowerFreePlace()
+bool writeToFd(int fd, const string &data)
 {
-    for (int i = 0; i < MAX_THREAD_NUM; ++i)
+    size_t written = 0;
+    while (written < data.size())
     {
-        if (envBinaryThreadPlaces[i] == 0)
-            return i;
+        ssize_t ret = write(fd, data.data() + written, data.size() - written);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return false;
+        written += ret;
     }
-    return -1;
+    return true;
 }
 
 /**
- * responsible to return the index of thread by tid
- * @param tid given tid
- * @return the index of thread by tid (if not exists - return -1)
+ * resumes a blocked thread (the signals should be blocked)
+ * @param tid the resumed tid
+ * @return 0 on success, -1 if no thread with ID tid exists
  */
-int getIndexOfThreadByTid(int tid)
+int resumeThread(int tid)
 {
+    if (tid < 0)
+    {
+        cerr << ERROR_LIB_MSG << "tid is not valid\n";
+        return ERROR;
+    }
     if (!isExistTid(tid))
-        return -1;
-    for (int i = 0; i < MAX_THREAD_NUM; ++i)
     {
-        if (gCurrentThreadsList[i] != nullptr)
-            if (gCurrentThreadsList[i]->getTid() == tid)
-                return i;
+        cerr << ERROR_LIB_MSG << "tid is not exists\n";
+        return ERROR;
     }
-    return -1;
+    gRuntime.unblock(gRuntime.get(tid), BLOCKED_BY_USER);
+    return 0;
 }
 
 /**
- * deletes thread from ready vector by tid
- * @param tid - given tid
- * @return true if found and deleted, false otherwise
+ * pushes a message to the inbox, from any kernel thread and without locks
+ * @param message the pushed message
+ * @return true on success, false if the inbox is full
  */
-bool deleteThreadFromReadyVector(int tid)
+bool pushToInbox(const inboxMessage &message)
 {
-    bool isFound = false;
-    int idx = 0;
-    for (auto &i : gReadyThreadsList)
+    size_t pos = gInboxEnqueuePos.load();
+    inboxCell *cell;
+    while (true)
     {
-        if (i)
+        cell = &gInbox[pos & INBOX_MASK];
+        long long distance = (long long)cell->sequence.load() - (long long)pos;
+        if (distance == 0)
         {
-            if (i->getTid() != tid)
-                ++idx;
-            else
-            {
-                isFound = true;
+            if (gInboxEnqueuePos.compare_exchange_weak(pos, pos + 1))
                 break;
-            }
         }
+        else if (distance < 0) // the scheduler didn't drain this cell yet
+            return false;
+        else
+            pos = gInboxEnqueuePos.load();
     }
-    if (isFound)
-        gReadyThreadsList.erase(gReadyThreadsList.begin() + (idx));
-    else
-        cerr << "thread not found\n";
-    return isFound;
+    cell->message = message;
+    cell->sequence.store(pos + 1);
+    // wake the scheduler if it is idle, and preempt the running thread if
+    // nothing else would make a scheduling decision (tickless mode)
+    if (!isInboxSignaled.exchange(true))
+    {
+        uint64_t one = 1;
+        if (write(inboxEventFd, &one, sizeof(one)) != sizeof(one))
+            cerr << ERROR_SYS_MSG << "eventfd write failed\n";
+    }
+    if (!isTimerArmed && !isIdle && !isDeterministic)
+        syscall(SYS_tgkill, getpid(), schedulerKernelTid, SIGVTALRM);
+    return true;
 }
 
 /**
- * return true if switched
- * @param caseOfSwitch reason why to switch
- * @return true if switched, false - otherwise
+ * handles the messages of the foreign kernel threads (the signals should be
+ * blocked). at most INBOX_SIZE messages are handled, so messages posted by
+ * the handled functions can't keep the scheduler here
  */
-bool switchThreads(int caseOfSwitch)
+void drainInbox()
 {
-    int ret_val;
-    ++totalQuantum;
-    switch (caseOfSwitch)
+    if (isInboxSignaled.exchange(false))
     {
-        case EXPIRED_TIME:
-            ret_val = sigsetjmp(runningThread->env, 1);
-            if (ret_val == 1)
-            {
-                return false;
-            }
-            runningThread->setState(READY);
-            gReadyThreadsList.push_back(runningThread);
-            runningThread = gReadyThreadsList.front();
-            runningThread->setState(RUNNING);
-            runningThread->setQuantum(runningThread->getQuantum()+1);
-            gReadyThreadsList.erase(gReadyThreadsList.begin());
-            siglongjmp(runningThread->env, 1);
-
-        case BLOCKED_THREAD_ITSELF:
-            ret_val = sigsetjmp(runningThread->env, 1);
-            if (ret_val == 1)
-            {
-                return false;
-            }
-            runningThread->setState(BLOCKED);
-            runningThread = gReadyThreadsList.front();
-            runningThread->setState(RUNNING);
-            runningThread->setQuantum(runningThread->getQuantum()+1);
-            gReadyThreadsList.erase(gReadyThreadsList.begin());
-            siglongjmp(runningThread->env, 1);
-            return true;
-
-        default:
-            return false;
+        uint64_t count;
+        if (read(inboxEventFd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+            cerr << ERROR_SYS_MSG << "eventfd read failed\n";
+    }
+    for (int handled = 0; handled < INBOX_SIZE; ++handled)
+    {
+        inboxCell &cell = gInbox[gInboxDequeuePos & INBOX_MASK];
+        if (cell.sequence.load() != gInboxDequeuePos + 1) // empty (or still being written)
+            return;
+        inboxMessage message = cell.message;
+        cell.sequence.store(gInboxDequeuePos + INBOX_SIZE);
+        ++gInboxDequeuePos;
+        if (message.fn != nullptr)
+            message.fn(message.arg);
+        else
+            resumeThread(message.tid);
+    }
+}
+
+/**
+ * in tickless mode, disarms the timer while no other thread is ready
+ */
+void updateTicklessTimer()
+{
+    if (!isTickless || !gRuntime.isReadyEmpty() || !isTimerArmed)
+        return;
+    disarmTimer();
+    // a message pushed before the timer was disarmed didn't kick the scheduler
+    drainInbox();
+    if (!gRuntime.isReadyEmpty())
+        armTimer();
+}
+
+/**
+ * sleeps the kernel thread while no thread is ready. only a message in the
+ * inbox (of a foreign kernel thread, or of a handler of another signal, e.g.
+ * of a timer or of I/O) can make a thread ready, so all the signals are
+ * blocked between the check of the READY queue and the sleep
+ */
+void waitForReadyThread()
+{
+    if (!gRuntime.isReadyEmpty())
+        return;
+    sigset_t allSignals, waitMask;
+    sigfillset(&allSignals);
+    if (sigprocmask(SIG_BLOCK, &allSignals, &waitMask))
+    {
+        cerr << ERROR_SYS_MSG << "signal mask error\n";
+        deleteAllThreads();
+        exit(ERROR);
+    }
+    disarmTimer();
+    isIdle = true;
+    drainInbox();
+    while (gRuntime.isReadyEmpty())
+    {
+        // waitMask keeps the timer signal blocked
+        struct pollfd inboxPoll = {inboxEventFd, POLLIN, 0};
+        ppoll(&inboxPoll, 1, nullptr, &waitMask);
+        drainInbox();
+    }
+    isIdle = false;
+    if (sigprocmask(SIG_SETMASK, &waitMask, nullptr))
+    {
+        cerr << ERROR_SYS_MSG << "signal mask error\n";
+        deleteAllThreads();
+        exit(ERROR);
     }
+    armTimer();
+}
+
+/**
+ * blocks the running thread until it is woken by wakeWaitingThread
+ */
+void waitRunningThread()
+{
+    gRuntime.block(gRuntime.getRunning(), BLOCKED_BY_WAIT);
+}
+
+/**
+ * entry point of the threads of uthread_parallel_for
+ */
+void parallelForWorker()
+{
+    parallelForTask task = gParallelForTasks[uthread_get_tid()];
+    task.fn(task.begin, task.end);
+    uthread_waitgroup_done(task.wg);
+    uthread_terminate(uthread_get_tid());
+}
+
+/**
+ * ends the quantum of the running thread (the timer signal should be blocked)
+ */
+void preemptRunningThread()
+{
+    drainInbox();
+    updateTicklessTimer();
+    if (isTickless && gRuntime.isReadyEmpty()) // no other thread to switch to
+        return;
+    gRuntime.preempt();
 }
 
 /**
@@ -235,7 +587,164 @@ bool switchThreads(int caseOfSwitch)
  */
 void signal_handler(int sig)
 {
-    switchThreads(EXPIRED_TIME);
+    if (isIdle)
+        return;
+    preemptRunningThread();
+}
+
+/**
+ * in tickless mode the running thread has to be preempted again
+ */
+void libraryHooks::onReady(libraryRuntime &runtime)
+{
+    if (isTickless && !isTimerArmed && !isIdle)
+        armTimer();
+}
+
+void libraryHooks::onSchedule(libraryRuntime &runtime)
+{
+    drainInbox();
+}
+
+void libraryHooks::onIdle(libraryRuntime &runtime)
+{
+    waitForReadyThread();
+}
+
+void libraryHooks::onQuantumStart(libraryRuntime &runtime)
+{
+    updateTicklessTimer();
+}
+
+/**
+ * the next thread gets a full quantum
+ */
+void libraryHooks::onYield(libraryRuntime &runtime)
+{
+    armTimer();
+}
+
+void libraryHooks::onTerminate(libraryRuntime &runtime, libraryThread &thread)
+{
+    destroySpecifics(&thread);
+    releaseJoined(&thread);
+}
+
+/**
+ * a new thread starts inside the critical section of the thread it was
+ * switched from: a signal which became pending there is handled only here,
+ * on the stack of the new thread
+ */
+void libraryHooks::onThreadStart(libraryRuntime &runtime)
+{
+    unBlockSignals();
+}
+
+/**
+ * the profiler signal handler: records the running thread and a frame
+ * pointer backtrace of the interrupted code. only frames inside the stack of
+ * the running thread are followed
+ * @param sig signal number
+ * @param info signal information
+ * @param context the interrupted context
+ */
+void profile_handler(int sig, siginfo_t *info, void *context)
+{
+    libraryThread *runningThread = gRuntime.getRunning();
+    if (gProfileSamples == nullptr || gProfileSamplesNum >= PROFILE_MAX_SAMPLES || runningThread == nullptr)
+        return;
+    auto *uc = (ucontext_t *)context;
+#ifdef __x86_64__
+    auto pc = (void *)uc->uc_mcontext.gregs[REG_RIP];
+    auto fp = (void **)uc->uc_mcontext.gregs[REG_RBP];
+#else
+    auto pc = (void *)uc->uc_mcontext.gregs[REG_EIP];
+    auto fp = (void **)uc->uc_mcontext.gregs[REG_EBP];
+#endif
+    char *stackLow = runningThread->stack;
+    char *stackHigh = stackLow + runningThread->stackSize;
+    if (runningThread->tid == 0)
+    {
+        stackLow = mainStackLow;
+        stackHigh = mainStackHigh;
+    }
+    profileSample &sample = gProfileSamples[gProfileSamplesNum];
+    sample.tid = runningThread->tid;
+    sample.frames[0] = pc;
+    sample.depth = 1;
+    while (sample.depth < PROFILE_MAX_DEPTH && (char *)fp >= stackLow &&
+           (char *)(fp + 2) <= stackHigh && ((size_t)fp % sizeof(void *)) == 0 && fp[1] != nullptr)
+    {
+        sample.frames[sample.depth++] = fp[1]; // the return address
+        if ((void **)fp[0] <= fp) // frames go up the stack
+            break;
+        fp = (void **)fp[0];
+    }
+    gProfileSamplesNum = gProfileSamplesNum + 1;
+}
+
+/**
+ * responsible to return the name of a code address for the folded stacks: the
+ * symbol if it is known, otherwise the module and the offset in it
+ * @param address the code address
+ * @param isReturnAddress true if the address follows a call instruction
+ * @return the name of the address
+ */
+string getFrameName(void *address, bool isReturnAddress)
+{
+    // a return address may already be the start of the next function
+    void *lookup = isReturnAddress ? (char *)address - 1 : address;
+    Dl_info dlInfo;
+    char name[64];
+    if (dladdr(lookup, &dlInfo) == 0 || dlInfo.dli_fname == nullptr)
+    {
+        snprintf(name, sizeof(name), "%p", address);
+        return name;
+    }
+    if (dlInfo.dli_sname != nullptr)
+    {
+        int status;
+        char *demangled = abi::__cxa_demangle(dlInfo.dli_sname, nullptr, nullptr, &status);
+        string symbol = (status == 0) ? demangled : dlInfo.dli_sname;
+        free(demangled);
+        return symbol;
+    }
+    string module = dlInfo.dli_fname;
+    if (module.find('/') != string::npos)
+        module = module.substr(module.rfind('/') + 1);
+    snprintf(name, sizeof(name), "+0x%lx", (unsigned long)((char *)lookup - (char *)dlInfo.dli_fbase));
+    return module + name;
+}
+
+/**
+ * folds the samples of gProfileFolding into "uthread-<tid>;<root>;...;<leaf> <count>"
+ * lines and writes them (entry point of the folding context of uthread_profile_stop)
+ */
+void foldProfileSamples()
+{
+    profileFolding &folding = gProfileFolding;
+    map<string, int> foldedStacks;
+    map<void *, string> frameNames;
+    for (int i = 0; i < folding.samplesNum; ++i)
+    {
+        profileSample &sample = folding.samples[i];
+        string stack = "uthread-" + std::to_string(sample.tid);
+        for (int depth = sample.depth - 1; depth >= 0; --depth)
+        {
+            void *frame = sample.frames[depth];
+            auto frameName = frameNames.find(frame);
+            if (frameName == frameNames.end())
+                frameName = frameNames.emplace(frame, getFrameName(frame, depth > 0)).first;
+            stack += ";" + frameName->second;
+        }
+        ++foldedStacks[stack];
+    }
+    delete[] folding.samples;
+    folding.samples = nullptr;
+    string folded;
+    for (auto &foldedStack : foldedStacks)
+        folded += foldedStack.first + " " + std::to_string(foldedStack.second) + "\n";
+    folding.isWritten = writeToFd(folding.fd, folded);
 }
 
 /*
@@ -253,37 +762,56 @@ int uthread_init(int quantum_usecs)
         cerr << ERROR_LIB_MSG << "quantum length is negative\n";
         return ERROR;
     }
-    ++totalQuantum;
+    sigemptyset(&set);
+    sigaddset(&set, SIGVTALRM);
+    sigaddset(&set, SIGPROF); // samples are not taken in the middle of the library
 
     // Install timer_handler as the signal handler for SIGVTALRM.
     sa.sa_handler = &signal_handler;
+    sa.sa_mask = set;
     if (sigaction(SIGVTALRM, &sa, nullptr) < 0)
     {
         cerr << ERROR_SYS_MSG << "sigaction failed\n";
         deleteAllThreads();
         exit(EXIT_FAILURE);
     }
-    auto* mainThread = new myThread(tidCounter++, nullptr);
-    mainThread->setState(RUNNING);
-    runningThread = mainThread;
-    runningThread->setQuantum(runningThread->getQuantum()+1);
-    if (getLowerFreePlace() != -1)
+    gRuntime.init();
+    timer.it_value.tv_sec = quantum_usecs / 1000000; // first time interval, seconds part
+    timer.it_value.tv_nsec = (quantum_usecs % 1000000) * 1000; // first time interval, nanoseconds part
+    timer.it_interval = timer.it_value; // following time intervals
+
+    // The inbox of the foreign kernel threads, and the kernel thread they kick
+    schedulerKernelTid = (pid_t)syscall(SYS_gettid);
+    inboxEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (inboxEventFd < 0)
+    {
+        cerr << ERROR_SYS_MSG << "eventfd failed\n";
+        deleteAllThreads();
+        exit(ERROR);
+    }
+    for (size_t i = 0; i < INBOX_SIZE; ++i)
+        gInbox[i].sequence.store(i);
+
+    if (isDeterministic) // the virtual clock replaces the timer
     {
-        gCurrentThreadsList[getLowerFreePlace()] = mainThread;
-        envBinaryThreadPlaces[getLowerFreePlace()] = 1;
+        armTimer();
+        return EXIT_SUCCESS;
     }
-    timer.it_value.tv_sec = 0; // first time interval, seconds part
-    timer.it_value.tv_usec = quantum_usecs; // first time interval, microseconds part
-    timer.it_interval.tv_sec = 0; // following time intervals, seconds part
-    timer.it_interval.tv_usec = quantum_usecs; // following time intervals, microseconds part
 
-    // Start a virtual timer. It counts down whenever this process is executing.
-    if (setitimer (ITIMER_VIRTUAL, &timer, nullptr))
+    // Start a CPU time timer of this kernel thread. It counts down whenever the
+    // threads of the library are executing, and only this kernel thread is
+    // interrupted by it (not other pthreads of the process).
+    struct sigevent timerEvent = {};
+    timerEvent.sigev_notify = SIGEV_THREAD_ID;
+    timerEvent.sigev_signo = SIGVTALRM;
+    timerEvent.sigev_notify_thread_id = schedulerKernelTid;
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &timerEvent, &quantumTimer))
     {
-        cerr << ERROR_SYS_MSG << "setitimer failed\n";
+        cerr << ERROR_SYS_MSG << "timer_create failed\n";
         deleteAllThreads();
         exit(ERROR);
     }
+    armTimer();
     return EXIT_SUCCESS;
 }
 
@@ -300,7 +828,7 @@ int uthread_init(int quantum_usecs)
 int uthread_spawn(void (*f)(void))
 {
     blockSignals();
-    if (getCurrentThreadsNumber() == MAX_THREAD_NUM)
+    if (gRuntime.isFull())
     {
         cerr << ERROR_LIB_MSG << "too much threads available\n";
         unBlockSignals();
@@ -312,94 +840,80 @@ int uthread_spawn(void (*f)(void))
         unBlockSignals();
         return ERROR;
     }
-    tidCounter = getLowerFreePlace();
-    auto* newThread = new myThread(tidCounter, f);
-    newThread->setState(READY);
-    gReadyThreadsList.push_back(newThread);
-    if (getLowerFreePlace() != -1)
-    {
-        gCurrentThreadsList[getLowerFreePlace()] = newThread;
-        envBinaryThreadPlaces[getLowerFreePlace()] = 1;
-    }
+    int newTid = gRuntime.spawn(f);
     unBlockSignals();
-    return tidCounter;
+    return newTid;
 }
 
 /*
- * Description: This function terminates the thread with ID tid and deletes
- * it from all relevant control structures. All the resources allocated by
- * the library for this thread should be released. If no thread with ID tid
- * exists it is considered as an error. Terminating the main thread
- * (tid == 0) will result in the termination of the entire process using
- * exit(0) [after releasing the assigned library memory].
- * Return value: The function returns 0 if the thread was successfully
- * terminated and -1 otherwise. If a thread terminates itself or the main
- * thread is terminated, the function does not return.
+ * Description: This function creates a new thread like uthread_spawn, except
+ * that the thread runs on one execution stack of SHARED_STACK_SIZE bytes which
+ * is shared by all the threads created by this function. Only the live part
+ * of the stack of a switched out thread is kept, in a heap buffer.
+ * Return value: On success, return the ID of the created thread.
+ * On failure, return -1.
 */
-int uthread_terminate(int tid)
+int uthread_spawn_shared(void (*f)(void))
 {
     blockSignals();
-    if (tid < 0)
+    if (gRuntime.isFull())
     {
-        cerr << ERROR_LIB_MSG << "tid is not valid\n";
+        cerr << ERROR_LIB_MSG << "too much threads available\n";
         unBlockSignals();
         return ERROR;
     }
-    if (tid == 0) // main thread
-    {
-        deleteAllThreads();
-        unBlockSignals();
-        exit(EXIT_SUCCESS);
-    }
-    if (!isExistTid(tid))
+    if (f == nullptr)
     {
-        cerr << ERROR_LIB_MSG << "tid is not exists\n";
+        cerr << ERROR_LIB_MSG << "entry point function is null\n";
         unBlockSignals();
         return ERROR;
     }
-    int indexOfDeletedThread = getIndexOfThreadByTid(tid);
-    if (indexOfDeletedThread == -1)
+    int newTid = gRuntime.spawnShared(f);
+    unBlockSignals();
+    return newTid;
+}
+
+/*
+ * Description: This function terminates the thread with ID tid and deletes
+ * it from all relevant control structures. All the resources allocated by
+ * the library for this thread should be released. If no thread with ID tid
+ * exists it is considered as an error. Terminating the main thread
+ * (tid == 0) will result in the termination of the entire process using
+ * exit(0) [after releasing the assigned library memory].
+ * Return value: The function returns 0 if the thread was successfully
+ * terminated and -1 otherwise. If a thread terminates itself or the main
+ * thread is terminated, the function does not return.
+*/
+int uthread_terminate(int tid)
+{
+    blockSignals();
+    if (tid < 0)
     {
-        cerr << ERROR_LIB_MSG << "tid is not exists\n";
+        cerr << ERROR_LIB_MSG << "tid is not valid\n";
         unBlockSignals();
         return ERROR;
     }
-    if (gCurrentThreadsList[indexOfDeletedThread]->getState() == READY)
-    {
-        deleteThreadFromReadyVector(tid);
-    }
-    if (runningThread->getTid() == tid) // case terminate itself
+    if (tid == 0) // main thread
     {
-        int ret_val = sigsetjmp(runningThread->env, 1);
-        if (ret_val == 1)
+        for (int i = 0; i < MAX_THREAD_NUM; ++i)
         {
-            return false;
+            if (gRuntime.get(i) != nullptr)
+                destroySpecifics(gRuntime.get(i));
         }
-        runningThread = gReadyThreadsList.front();
-        runningThread->setState(RUNNING);
-        runningThread->setQuantum(runningThread->getQuantum()+1);
-        gReadyThreadsList.erase(gReadyThreadsList.begin());
-        delete gCurrentThreadsList[indexOfDeletedThread];
-        gCurrentThreadsList[indexOfDeletedThread] = nullptr;
-        envBinaryThreadPlaces[indexOfDeletedThread] = 0;
-        releaseSynced(tid);
+        // the signals stay blocked, no handler may run on a deleted stack
+        deleteAllThreads();
+        exit(EXIT_SUCCESS);
+    }
+    if (!isExistTid(tid))
+    {
+        cerr << ERROR_LIB_MSG << "tid is not exists\n";
         unBlockSignals();
-        tidCounter = getLowerFreePlace();
-        if (setitimer (ITIMER_VIRTUAL, &timer, nullptr))
-        {
-            cerr << ERROR_SYS_MSG << "setitimer failed\n";
-            deleteAllThreads();
-            exit(ERROR);
-        }
-        siglongjmp(runningThread->env, 1);
-        return 0;
+        return ERROR;
     }
-    delete gCurrentThreadsList[indexOfDeletedThread];
-    gCurrentThreadsList[indexOfDeletedThread] = nullptr;
-    envBinaryThreadPlaces[indexOfDeletedThread] = 0;
-    releaseSynced(tid);
+    // a thread which terminates itself doesn't return, the signals stay
+    // blocked until the jump restores the mask of the next thread
+    gRuntime.terminate(gRuntime.get(tid));
     unBlockSignals();
-    tidCounter = getLowerFreePlace();
     return 0;
 }
 
@@ -433,30 +947,12 @@ int uthread_block(int tid)
         unBlockSignals();
         return ERROR;
     }
-    if (runningThread->getTid() == tid) // thread block itself
-    {
-        if (!blockCalledFromSync)
-            runningThread->setIsBlockedNotBySynced(true);
-        blockCalledFromSync = false;
-        if (setitimer (ITIMER_VIRTUAL, &timer, nullptr))
-        {
-            cerr << ERROR_SYS_MSG << "setitimer failed\n";
-            deleteAllThreads();
-            exit(ERROR);
-        }
-        switchThreads(BLOCKED_THREAD_ITSELF);
-    }
-    else // thread block other
-    {
-        int threadPlace = getIndexOfThreadByTid(tid);
-        if (threadPlace != -1)
-            if (gCurrentThreadsList[threadPlace]->getState() == READY)
-            {
-                gCurrentThreadsList[threadPlace]->setState(BLOCKED);
-                gCurrentThreadsList[threadPlace]->setIsBlockedNotBySynced(true);
-                deleteThreadFromReadyVector(tid);
-            }
-    }
+    libraryThread *blockedThread = gRuntime.get(tid);
+    // blocking a BLOCKED thread has no effect, so a thread that waits isn't
+    // also held until it is resumed. a thread which blocks itself returns
+    // when it is resumed
+    if (blockedThread->state != BLOCKED)
+        gRuntime.block(blockedThread, BLOCKED_BY_USER);
     unBlockSignals();
     return 0;
 }
@@ -471,36 +967,9 @@ int uthread_block(int tid)
 int uthread_resume(int tid)
 {
     blockSignals();
-    if (tid < 0)
-    {
-        cerr << ERROR_LIB_MSG << "tid is not valid\n";
-        unBlockSignals();
-        return ERROR;
-    }
-    if (!isExistTid(tid))
-    {
-        cerr << ERROR_LIB_MSG << "tid is not exists\n";
-        unBlockSignals();
-        return ERROR;
-    }
-    int indexOfResumedThread = getIndexOfThreadByTid(tid);
-    if (indexOfResumedThread == -1)
-    {
-        cerr << ERROR_LIB_MSG << "tid is not exists\n";
-        unBlockSignals();
-        return ERROR;
-    }
-    gCurrentThreadsList[indexOfResumedThread]->setIsBlockedNotBySynced(false);
-    if (gCurrentThreadsList[indexOfResumedThread]->getState() == BLOCKED)
-    {
-        if (gCurrentThreadsList[indexOfResumedThread]->getSyncedTid() == -1)
-        {
-            gCurrentThreadsList[indexOfResumedThread]->setState(READY);
-            gReadyThreadsList.push_back(gCurrentThreadsList[indexOfResumedThread]);
-        }
-    }
+    int result = resumeThread(tid);
     unBlockSignals();
-    return 0;
+    return result;
 }
 
 /*
@@ -520,7 +989,7 @@ int uthread_sync(int tid)
         unBlockSignals();
         return ERROR;
     }
-    if (runningThread->getTid() == 0) // main thread calls the function is error
+    if (gRuntime.getRunning()->tid == 0) // main thread calls the function is error
     {
         cerr << ERROR_LIB_MSG << "you can't call sync function from main thread\n";
         unBlockSignals();
@@ -532,22 +1001,15 @@ int uthread_sync(int tid)
         unBlockSignals();
         return ERROR;
     }
-    if (runningThread->getTid() == tid) // case 'thread tid calls this function'
+    if (gRuntime.getRunning()->tid == tid) // case 'thread tid calls this function'
     {
         cerr << ERROR_LIB_MSG << "thread tid calls this function\n";
         unBlockSignals();
         return ERROR;
     }
-    runningThread->setSyncedTid(tid);
-    blockCalledFromSync = true;
-    if (uthread_block(runningThread->getTid()) == ERROR)
-    {
-        cerr << ERROR_LIB_MSG << "sync failed\n";
-        unBlockSignals();
-        return ERROR;
-    }
+    gRuntime.sync(gRuntime.get(tid));
     unBlockSignals();
-    return ERROR;
+    return 0;
 }
 
 /*
@@ -556,7 +1018,7 @@ int uthread_sync(int tid)
 */
 int uthread_get_tid()
 {
-    return runningThread->getTid();
+    return gRuntime.getRunning()->tid;
 }
 
 /*
@@ -569,7 +1031,7 @@ int uthread_get_tid()
 */
 int uthread_get_total_quantums()
 {
-    return totalQuantum;
+    return gRuntime.getTotalQuantums();
 }
 
 /*
@@ -593,6 +1055,666 @@ int uthread_get_quantums(int tid)
         cerr << ERROR_LIB_MSG << "tid is not exists\n";
         return ERROR;
     }
-    int indexOfQuantumedThread = getIndexOfThreadByTid(tid);
-    return gCurrentThreadsList[indexOfQuantumedThread]->getQuantum();
+    return libraryRuntime::getQuantums(*gRuntime.get(tid));
+}
+
+/*
+ * Description: This function creates a new thread group with the given
+ * weight. Quantums are divided between the groups that have READY threads by
+ * a weighted-fair (stride) algorithm, and inside a group the threads are
+ * scheduled by round robin. It is an error to call this function with a
+ * weight which is not in the range [1, MAX_GROUP_WEIGHT], or if it would
+ * cause the number of groups to exceed MAX_GROUP_NUM.
+ * Return value: On success, return the ID of the created group.
+ * On failure, return -1.
+*/
+int uthread_group_create(int weight)
+{
+    blockSignals();
+    if (weight <= 0 || weight > MAX_GROUP_WEIGHT)
+    {
+        cerr << ERROR_LIB_MSG << "group weight is not valid\n";
+        unBlockSignals();
+        return ERROR;
+    }
+    int group = gRuntime.scheduler().createGroup(weight);
+    if (group == -1)
+        cerr << ERROR_LIB_MSG << "too much groups available\n";
+    unBlockSignals();
+    return group;
+}
+
+/*
+ * Description: This function moves the thread with ID tid to the group with
+ * ID group. The quantum the thread is currently running in (if any) stays
+ * charged to its previous group. If no thread with ID tid or no group with
+ * ID group exists it is considered an error.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_group_attach(int tid, int group)
+{
+    blockSignals();
+    if (!gRuntime.scheduler().isGroup(group))
+    {
+        cerr << ERROR_LIB_MSG << "group is not exists\n";
+        unBlockSignals();
+        return ERROR;
+    }
+    if (!isExistTid(tid))
+    {
+        cerr << ERROR_LIB_MSG << "tid is not exists\n";
+        unBlockSignals();
+        return ERROR;
+    }
+    gRuntime.scheduler().attach(*gRuntime.get(tid), group);
+    unBlockSignals();
+    return 0;
+}
+
+/*
+ * Description: This function returns the number of quantums that were
+ * started by threads of the group with ID group since the library was
+ * initialized, including quantums of threads that were already terminated.
+ * If no group with ID group exists it is considered an error.
+ * Return value: On success, return the number of quantums of the group.
+ * On failure, return -1.
+*/
+int uthread_group_get_quantums(int group)
+{
+    if (!gRuntime.scheduler().isGroup(group))
+    {
+        cerr << ERROR_LIB_MSG << "group is not exists\n";
+        return ERROR;
+    }
+    return gRuntime.scheduler().getGroupQuantums(group);
+}
+
+/*
+ * Description: This function turns the tickless mode on (enable != 0) or off
+ * (enable == 0). In tickless mode the quantum timer is disarmed while the
+ * running thread is the only thread which is not BLOCKED, so a lone thread
+ * is not interrupted (and no new quantums are counted) until another thread
+ * becomes READY. The mode is off after uthread_init.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_set_tickless(int enable)
+{
+    blockSignals();
+    isTickless = (enable != 0);
+    if (!isTimerArmed)
+        armTimer();
+    updateTicklessTimer();
+    unBlockSignals();
+    return 0;
+}
+
+/*
+ * Description: This function initializes the wait group wg with a zero
+ * counter and no waiting thread. It is an error to call this function with
+ * a null wg.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_waitgroup_init(uthread_waitgroup_t *wg)
+{
+    if (wg == nullptr)
+    {
+        cerr << ERROR_LIB_MSG << "wait group is null\n";
+        return ERROR;
+    }
+    wg->counter = 0;
+    wg->waiterTid = -1;
+    return 0;
+}
+
+/*
+ * Description: This function adds delta (which may be negative) to the
+ * counter of the wait group wg. When the counter drops to zero the waiting
+ * thread (if any) is woken exactly once. It is an error to call this function
+ * with a null wg or with a delta which would make the counter negative.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_waitgroup_add(uthread_waitgroup_t *wg, int delta)
+{
+    blockSignals();
+    if (wg == nullptr)
+    {
+        cerr << ERROR_LIB_MSG << "wait group is null\n";
+        unBlockSignals();
+        return ERROR;
+    }
+    if ((long long)wg->counter + delta < 0)
+    {
+        cerr << ERROR_LIB_MSG << "wait group counter is negative\n";
+        unBlockSignals();
+        return ERROR;
+    }
+    wg->counter += delta;
+    if (wg->counter == 0 && wg->waiterTid != -1)
+    {
+        libraryThread *waiter = gRuntime.get(wg->waiterTid);
+        wg->waiterTid = -1;
+        if (waiter != nullptr)
+            wakeWaitingThread(waiter);
+    }
+    unBlockSignals();
+    return 0;
+}
+
+/*
+ * Description: This function decrements the counter of the wait group wg by
+ * one. It is the same as uthread_waitgroup_add(wg, -1).
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_waitgroup_done(uthread_waitgroup_t *wg)
+{
+    return uthread_waitgroup_add(wg, -1);
+}
+
+/*
+ * Description: This function blocks the RUNNING thread until the counter of
+ * the wait group wg drops to zero. If the counter is already zero the
+ * function returns immediately. It is an error to call this function with a
+ * null wg or if another thread already waits on wg.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_waitgroup_wait(uthread_waitgroup_t *wg)
+{
+    blockSignals();
+    if (wg == nullptr)
+    {
+        cerr << ERROR_LIB_MSG << "wait group is null\n";
+        unBlockSignals();
+        return ERROR;
+    }
+    if (wg->counter == 0)
+    {
+        unBlockSignals();
+        return 0;
+    }
+    if (wg->waiterTid != -1)
+    {
+        cerr << ERROR_LIB_MSG << "another thread waits on the wait group\n";
+        unBlockSignals();
+        return ERROR;
+    }
+    wg->waiterTid = gRuntime.getRunning()->tid;
+    gRuntime.getRunning()->data.waitGroup = wg;
+    waitRunningThread();
+    unBlockSignals();
+    return 0;
+}
+
+/*
+ * Description: This function blocks the RUNNING thread until any of the n
+ * threads whose IDs are in tids terminates. It is an error to call this
+ * function with a null tids or a non-positive n, if no thread with one of the
+ * IDs exists or if one of the IDs is the ID of the RUNNING thread.
+ * Return value: On success, return the ID of the terminated thread.
+ * On failure, return -1.
+*/
+int uthread_join_any(const int *tids, int n)
+{
+    blockSignals();
+    if (tids == nullptr || n <= 0)
+    {
+        cerr << ERROR_LIB_MSG << "tids are not valid\n";
+        unBlockSignals();
+        return ERROR;
+    }
+    for (int i = 0; i < n; ++i)
+    {
+        if (tids[i] < 0 || !isExistTid(tids[i]))
+        {
+            cerr << ERROR_LIB_MSG << "tid is not exists\n";
+            unBlockSignals();
+            return ERROR;
+        }
+        if (tids[i] == gRuntime.getRunning()->tid)
+        {
+            cerr << ERROR_LIB_MSG << "thread tid calls this function\n";
+            unBlockSignals();
+            return ERROR;
+        }
+    }
+    libraryThread *runningThread = gRuntime.getRunning();
+    runningThread->data.joinTids = new int[n];
+    memcpy(runningThread->data.joinTids, tids, n * sizeof(int));
+    runningThread->data.joinTidsNum = n;
+    ++gJoiningNum;
+    waitRunningThread();
+    int joinedTid = gRuntime.getRunning()->data.joinedTid;
+    unBlockSignals();
+    return joinedTid;
+}
+
+/*
+ * Description: This function splits the range [begin, end) into chunks of at
+ * most grain elements, calls fn(chunkBegin, chunkEnd) for every chunk in a
+ * new thread and blocks the RUNNING thread until all the chunks are done.
+ * When the number of threads reaches MAX_THREAD_NUM the RUNNING thread runs
+ * the next chunk by itself. It is an error to call this function with
+ * begin > end, a non-positive grain or a null fn.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_parallel_for(int begin, int end, int grain, void (*fn)(int begin, int end))
+{
+    if (begin > end || grain <= 0 || fn == nullptr)
+    {
+        cerr << ERROR_LIB_MSG << "parallel for arguments are not valid\n";
+        return ERROR;
+    }
+    // the workers don't point into the stack of the caller, which may be shared
+    auto *wg = new uthread_waitgroup_t;
+    uthread_waitgroup_init(wg);
+    blockSignals();
+    int chunkBegin = begin;
+    while (chunkBegin < end)
+    {
+        int chunkEnd = (end - (long long)chunkBegin > grain) ? chunkBegin + grain : end;
+        if (!gRuntime.isFull())
+        {
+            int workerTid = gRuntime.spawn(parallelForWorker);
+            gParallelForTasks[workerTid] = {fn, chunkBegin, chunkEnd, wg};
+            ++wg->counter;
+        }
+        else // no free thread, the running thread does the chunk by itself
+        {
+            unBlockSignals();
+            fn(chunkBegin, chunkEnd);
+            blockSignals();
+        }
+        chunkBegin = chunkEnd;
+    }
+    unBlockSignals();
+    int result = uthread_waitgroup_wait(wg);
+    delete wg;
+    return result;
+}
+
+/*
+ * Description: This function creates a new thread-local storage key. Every
+ * thread has its own value for the key, which is null until the thread sets
+ * it. When a thread is terminated and its value for the key is not null, the
+ * destructor (if not null) is called with the value. It is an error to call
+ * this function if it would cause the number of keys to exceed MAX_KEY_NUM.
+ * Return value: On success, return the created key. On failure, return -1.
+*/
+int uthread_key_create(void (*destructor)(void *))
+{
+    blockSignals();
+    for (int key = 0; key < MAX_KEY_NUM; ++key)
+    {
+        if (!gIsKeyUsed[key])
+        {
+            gIsKeyUsed[key] = true;
+            gKeyDestructors[key] = destructor;
+            unBlockSignals();
+            return key;
+        }
+    }
+    cerr << ERROR_LIB_MSG << "too much keys available\n";
+    unBlockSignals();
+    return ERROR;
+}
+
+/*
+ * Description: This function deletes the thread-local storage key. The
+ * values of the key are cleared in all the threads without calling the
+ * destructor. If no key with this value exists it is considered an error.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_key_delete(int key)
+{
+    blockSignals();
+    if (!isExistKey(key))
+    {
+        cerr << ERROR_LIB_MSG << "key is not exists\n";
+        unBlockSignals();
+        return ERROR;
+    }
+    for (int tid = 0; tid < MAX_THREAD_NUM; ++tid)
+    {
+        if (gRuntime.get(tid) != nullptr)
+            gRuntime.get(tid)->data.specific[key] = nullptr;
+    }
+    gIsKeyUsed[key] = false;
+    gKeyDestructors[key] = nullptr;
+    unBlockSignals();
+    return 0;
+}
+
+/*
+ * Description: This function returns the value of the key for the calling
+ * thread. If no key with this value exists it is considered an error.
+ * Return value: On success, return the value of the key (null if it was not
+ * set by the calling thread). On failure, return null.
+*/
+void *uthread_getspecific(int key)
+{
+    if (!isExistKey(key))
+    {
+        cerr << ERROR_LIB_MSG << "key is not exists\n";
+        return nullptr;
+    }
+    return gRuntime.getRunning()->data.specific[key];
+}
+
+/*
+ * Description: This function sets the value of the key for the calling
+ * thread. If no key with this value exists it is considered an error.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_setspecific(int key, const void *value)
+{
+    if (!isExistKey(key))
+    {
+        cerr << ERROR_LIB_MSG << "key is not exists\n";
+        return ERROR;
+    }
+    gRuntime.getRunning()->data.specific[key] = const_cast<void *>(value);
+    return 0;
+}
+
+/*
+ * Description: This function resumes the thread with ID tid like
+ * uthread_resume, but it may be called from any kernel thread (pthread) of
+ * the process, and from a signal handler. The request is pushed to a
+ * lock-free inbox of INBOX_SIZE messages and is handled by the scheduler at
+ * its next scheduling decision. It is an error to call this function with a tid which is not in the range
+ * [0, MAX_THREAD_NUM), or when the inbox is full.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_resume_external(int tid)
+{
+    if (tid < 0 || tid >= MAX_THREAD_NUM)
+    {
+        cerr << ERROR_LIB_MSG << "tid is not valid\n";
+        return ERROR;
+    }
+    if (!pushToInbox({nullptr, nullptr, tid}))
+    {
+        cerr << ERROR_LIB_MSG << "inbox is full\n";
+        return ERROR;
+    }
+    return 0;
+}
+
+/*
+ * Description: This function makes the scheduler call fn(arg) at its next
+ * scheduling decision, and it may be called from any kernel thread (pthread)
+ * of the process, and from a signal handler. It is an error to call this function with a null fn, or
+ * when the inbox is full.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_post(void (*fn)(void *), void *arg)
+{
+    if (fn == nullptr)
+    {
+        cerr << ERROR_LIB_MSG << "posted function is null\n";
+        return ERROR;
+    }
+    if (!pushToInbox({fn, arg, -1}))
+    {
+        cerr << ERROR_LIB_MSG << "inbox is full\n";
+        return ERROR;
+    }
+    return 0;
+}
+
+/*
+ * Description: This function initializes the thread library like
+ * uthread_init, in deterministic mode: no timer preempts the threads, and
+ * instead a virtual clock is advanced by uthread_tick. The budget of every
+ * quantum is quantum_ticks ticks if seed is 0, and otherwise a pseudo random
+ * number of ticks in [1, quantum_ticks] drawn from seed.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_init_deterministic(int quantum_ticks, unsigned int seed)
+{
+    if (quantum_ticks <= 0)
+    {
+        cerr << ERROR_LIB_MSG << "quantum length is negative\n";
+        return ERROR;
+    }
+    isDeterministic = true;
+    quantumTicks = quantum_ticks;
+    // the seed is spread so that close seeds give unrelated schedules
+    scheduleRandomState = (seed == 0) ? 0 : (seed + 0x9E3779B97F4A7C15ULL) * 0xBF58476D1CE4E5B9ULL;
+    if (seed != 0 && scheduleRandomState == 0)
+        scheduleRandomState = 1;
+    return uthread_init(quantum_ticks);
+}
+
+/*
+ * Description: This function advances the virtual clock by ticks. When the
+ * budget of the current quantum runs out, the RUNNING thread is preempted as
+ * if its quantum had expired. Without deterministic mode the function does
+ * nothing. It is an error to call this function with non-positive ticks.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_tick(int ticks)
+{
+    if (ticks <= 0)
+    {
+        cerr << ERROR_LIB_MSG << "ticks are not positive\n";
+        return ERROR;
+    }
+    if (!isDeterministic)
+        return 0;
+    blockSignals();
+    virtualTime += ticks;
+    if (quantumTicksLeft != BUDGET_DISARMED)
+    {
+        if (quantumTicksLeft == BUDGET_NOT_DRAWN)
+            quantumTicksLeft = drawQuantumBudget();
+        quantumTicksLeft -= ticks;
+        if (quantumTicksLeft <= 0)
+        {
+            armTimer(); // the budget of the next quantum
+            preemptRunningThread();
+        }
+    }
+    unBlockSignals();
+    return 0;
+}
+
+/*
+ * Description: This function returns the number of ticks of the virtual
+ * clock since the library was initialized in deterministic mode.
+ * Return value: The virtual time in ticks.
+*/
+long long uthread_get_virtual_time()
+{
+    return virtualTime;
+}
+
+/*
+ * Description: This function writes the budgets of all the quantums so far,
+ * one number of ticks per line, to the file descriptor fd. It is an error to
+ * call this function without deterministic mode or if the write fails.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_schedule_save(int fd)
+{
+    if (!isDeterministic)
+    {
+        cerr << ERROR_LIB_MSG << "not in deterministic mode\n";
+        return ERROR;
+    }
+    blockSignals();
+    string schedule;
+    for (int budget : gScheduleLog)
+        schedule += std::to_string(budget) + "\n";
+    unBlockSignals();
+    if (!writeToFd(fd, schedule))
+    {
+        cerr << ERROR_SYS_MSG << "write failed\n";
+        return ERROR;
+    }
+    return 0;
+}
+
+/*
+ * Description: This function reads budgets written by uthread_schedule_save
+ * from the file descriptor fd, and the following quantums use them in order
+ * instead of drawing new budgets. Called right after
+ * uthread_init_deterministic, it replays the recorded run exactly. It is an
+ * error to call this function without deterministic mode, if the read fails
+ * or if the file has a budget which is not a positive number.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_schedule_load(int fd)
+{
+    if (!isDeterministic)
+    {
+        cerr << ERROR_LIB_MSG << "not in deterministic mode\n";
+        return ERROR;
+    }
+    string schedule;
+    char buffer[4096];
+    ssize_t ret;
+    while ((ret = read(fd, buffer, sizeof(buffer))) != 0)
+    {
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0)
+        {
+            cerr << ERROR_SYS_MSG << "read failed\n";
+            return ERROR;
+        }
+        schedule.append(buffer, ret);
+    }
+    vector<int> budgets;
+    const char *pos = schedule.c_str();
+    while (true)
+    {
+        while (*pos == '\n' || *pos == ' ' || *pos == '\r' || *pos == '\t')
+            ++pos;
+        if (*pos == '\0')
+            break;
+        char *end;
+        long budget = strtol(pos, &end, 10);
+        if (end == pos || budget <= 0 || budget > 0x7fffffff)
+        {
+            cerr << ERROR_LIB_MSG << "schedule is not valid\n";
+            return ERROR;
+        }
+        budgets.push_back((int)budget);
+        pos = end;
+    }
+    blockSignals();
+    gReplaySchedule = budgets;
+    gReplayPos = 0;
+    unBlockSignals();
+    return 0;
+}
+
+/*
+ * Description: This function starts the sampling profiler: every
+ * sample_usecs micro-seconds of CPU time of the library, the ID of the
+ * RUNNING thread and a frame pointer backtrace of it are recorded. It is an
+ * error to call this function with non-positive sample_usecs or while the
+ * profiler runs.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_profile_start(int sample_usecs)
+{
+    if (sample_usecs <= 0)
+    {
+        cerr << ERROR_LIB_MSG << "sample interval is not positive\n";
+        return ERROR;
+    }
+    if (isProfiling)
+    {
+        cerr << ERROR_LIB_MSG << "profiler already runs\n";
+        return ERROR;
+    }
+    pthread_attr_t mainAttr;
+    void *mainStackAddr;
+    size_t mainStackSize;
+    if (pthread_getattr_np(pthread_self(), &mainAttr) ||
+        pthread_attr_getstack(&mainAttr, &mainStackAddr, &mainStackSize))
+    {
+        cerr << ERROR_SYS_MSG << "pthread_getattr_np failed\n";
+        return ERROR;
+    }
+    pthread_attr_destroy(&mainAttr);
+    blockSignals();
+    mainStackLow = (char *)mainStackAddr;
+    mainStackHigh = mainStackLow + mainStackSize;
+    gProfileSamples = new profileSample[PROFILE_MAX_SAMPLES];
+    gProfileSamplesNum = 0;
+
+    struct sigaction profileSa = {};
+    profileSa.sa_sigaction = &profile_handler;
+    profileSa.sa_flags = SA_SIGINFO | SA_RESTART;
+    profileSa.sa_mask = set;
+    struct sigevent timerEvent = {};
+    timerEvent.sigev_notify = SIGEV_THREAD_ID;
+    timerEvent.sigev_signo = SIGPROF;
+    timerEvent.sigev_notify_thread_id = schedulerKernelTid;
+    struct itimerspec sampleTimer;
+    sampleTimer.it_value.tv_sec = sample_usecs / 1000000;
+    sampleTimer.it_value.tv_nsec = (sample_usecs % 1000000) * 1000;
+    sampleTimer.it_interval = sampleTimer.it_value;
+    if (sigaction(SIGPROF, &profileSa, nullptr) < 0 ||
+        timer_create(CLOCK_THREAD_CPUTIME_ID, &timerEvent, &profileTimer))
+    {
+        cerr << ERROR_SYS_MSG << "profile timer failed\n";
+        delete[] gProfileSamples;
+        gProfileSamples = nullptr;
+        unBlockSignals();
+        return ERROR;
+    }
+    if (timer_settime(profileTimer, 0, &sampleTimer, nullptr))
+    {
+        cerr << ERROR_SYS_MSG << "timer_settime failed\n";
+        timer_delete(profileTimer);
+        delete[] gProfileSamples;
+        gProfileSamples = nullptr;
+        unBlockSignals();
+        return ERROR;
+    }
+    isProfiling = true;
+    unBlockSignals();
+    return 0;
+}
+
+/*
+ * Description: This function stops the sampling profiler and writes the
+ * samples to the file descriptor fd as folded stacks for flame graphs, split
+ * by thread: every line is "uthread-<tid>;<root frame>;...;<leaf frame> <count>".
+ * It is an error to call this function when the profiler doesn't run or if
+ * the write fails.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_profile_stop(int fd)
+{
+    blockSignals();
+    if (!isProfiling)
+    {
+        cerr << ERROR_LIB_MSG << "profiler doesn't run\n";
+        unBlockSignals();
+        return ERROR;
+    }
+    stopProfileTimer();
+    gProfileFolding = {gProfileSamples, gProfileSamplesNum, fd, false};
+    gProfileSamples = nullptr;
+    // the folding and the symbols need much more than the stack of a thread,
+    // and the signals stay blocked so no switch happens on the folding stack
+    char *foldStack = new char[PROFILE_FOLD_STACK_SIZE];
+    getcontext(&profileFoldContext);
+    profileFoldContext.uc_stack.ss_sp = foldStack;
+    profileFoldContext.uc_stack.ss_size = PROFILE_FOLD_STACK_SIZE;
+    profileFoldContext.uc_link = &profileCallerContext;
+    makecontext(&profileFoldContext, foldProfileSamples, 0);
+    swapcontext(&profileCallerContext, &profileFoldContext);
+    delete[] foldStack;
+    unBlockSignals();
+    if (!gProfileFolding.isWritten)
+    {
+        cerr << ERROR_SYS_MSG << "write failed\n";
+        return ERROR;
+    }
+    return 0;
 }
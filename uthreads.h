@@ -6,8 +6,32 @@
  * Author: OS, os@cs.huji.ac.il
  */
 
-#define MAX_THREAD_NUM 100 /* maximal number of threads */
+/* maximal number of threads. it may be raised on the command line (e.g.
+   -DMAX_THREAD_NUM=100001 for masses of shared-stack threads) when the
+   library and the code which uses it are compiled with the same value */
+#ifndef MAX_THREAD_NUM
+#define MAX_THREAD_NUM 100
+#endif
 #define STACK_SIZE 4096 /* stack size per thread (in bytes) */
+#define MAX_GROUP_NUM 16 /* maximal number of thread groups (including the default group) */
+#define MAX_GROUP_WEIGHT 10000 /* maximal weight of a thread group */
+#define DEFAULT_GROUP_WEIGHT 1 /* weight of the default group (group 0) */
+#define MAX_KEY_NUM 16 /* maximal number of thread-local storage keys */
+#define SHARED_STACK_SIZE (64 * 1024) /* size of the stack shared by the shared-stack threads (in bytes) */
+#define INBOX_SIZE 1024 /* maximal number of pending messages of foreign threads (a power of 2) */
+#define PROFILE_MAX_SAMPLES (64 * 1024) /* maximal number of samples of the profiler */
+#define PROFILE_MAX_DEPTH 16 /* maximal number of frames of a sample */
+
+/*
+ * A wait group counts outstanding tasks. One thread at a time may wait until
+ * the counter drops to zero. Initialize it with uthread_waitgroup_init before
+ * any other use.
+ */
+typedef struct
+{
+    int counter; /* number of outstanding tasks */
+    int waiterTid; /* the thread waiting for the counter to drop to zero, -1 if none */
+} uthread_waitgroup_t;
 
 /* External interface */
 
@@ -35,6 +59,22 @@ int uthread_init(int quantum_usecs);
 int uthread_spawn(void (*f)(void));
 
 
+/*
+ * Description: This function creates a new thread like uthread_spawn, except
+ * that the thread runs on one execution stack of SHARED_STACK_SIZE bytes which
+ * is shared by all the threads created by this function. When another
+ * shared-stack thread needs the stack, only the live part of the stack of its
+ * current owner is copied to a heap buffer of the same size, and it is copied
+ * back before the owner runs again. The memory of such a thread is therefore
+ * proportional to its actual stack depth, at the cost of slower switches
+ * between shared-stack threads. Addresses of local variables of a
+ * shared-stack thread must not be used by other threads.
+ * Return value: On success, return the ID of the created thread.
+ * On failure, return -1.
+*/
+int uthread_spawn_shared(void (*f)(void));
+
+
 /*
  * Description: This function terminates the thread with ID tid and deletes
  * it from all relevant control structures. All the resources allocated by
@@ -112,5 +152,278 @@ int uthread_get_total_quantums();
 */
 int uthread_get_quantums(int tid);
 
+
+/*
+ * Description: This function creates a new thread group with the given
+ * weight. Quantums are divided between the groups that have READY threads by
+ * a weighted-fair (stride) algorithm, so that under overload every group
+ * receives a share of the quantums proportional to its weight. Inside a group
+ * the threads are scheduled by round robin. Every thread starts in the default
+ * group 0, whose weight is DEFAULT_GROUP_WEIGHT. Groups are never destroyed.
+ * It is an error to call this function with a weight which is not in the
+ * range [1, MAX_GROUP_WEIGHT], or if it would cause the number of groups to
+ * exceed MAX_GROUP_NUM.
+ * Return value: On success, return the ID of the created group.
+ * On failure, return -1.
+*/
+int uthread_group_create(int weight);
+
+
+/*
+ * Description: This function moves the thread with ID tid to the group with
+ * ID group. The quantum the thread is currently running in (if any) stays
+ * charged to its previous group. If no thread with ID tid or no group with
+ * ID group exists it is considered an error.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_group_attach(int tid, int group);
+
+
+/*
+ * Description: This function returns the number of quantums that were
+ * started by threads of the group with ID group since the library was
+ * initialized, including quantums of threads that were already terminated.
+ * If no group with ID group exists it is considered an error.
+ * Return value: On success, return the number of quantums of the group.
+ * On failure, return -1.
+*/
+int uthread_group_get_quantums(int group);
+
+
+/*
+ * Description: This function turns the tickless mode on (enable != 0) or off
+ * (enable == 0). In tickless mode the quantum timer is disarmed while the
+ * running thread is the only thread which is not BLOCKED, so a lone thread
+ * is not interrupted (and no new quantums are counted) until another thread
+ * becomes READY. The mode is off after uthread_init.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_set_tickless(int enable);
+
+
+/*
+ * Description: This function initializes the wait group wg with a zero
+ * counter and no waiting thread. It is an error to call this function with
+ * a null wg.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_waitgroup_init(uthread_waitgroup_t *wg);
+
+
+/*
+ * Description: This function adds delta (which may be negative) to the
+ * counter of the wait group wg. When the counter drops to zero the waiting
+ * thread (if any) is woken exactly once. It is an error to call this function
+ * with a null wg or with a delta which would make the counter negative.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_waitgroup_add(uthread_waitgroup_t *wg, int delta);
+
+
+/*
+ * Description: This function decrements the counter of the wait group wg by
+ * one. It is the same as uthread_waitgroup_add(wg, -1).
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_waitgroup_done(uthread_waitgroup_t *wg);
+
+
+/*
+ * Description: This function blocks the RUNNING thread until the counter of
+ * the wait group wg drops to zero. If the counter is already zero the
+ * function returns immediately. Unlike uthread_sync, the main thread may call
+ * this function. It is an error to call this function with a null wg or if
+ * another thread already waits on wg.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_waitgroup_wait(uthread_waitgroup_t *wg);
+
+
+/*
+ * Description: This function blocks the RUNNING thread until any of the n
+ * threads whose IDs are in tids terminates. Unlike uthread_sync, the main
+ * thread may call this function. It is an error to call this function with a
+ * null tids or a non-positive n, if no thread with one of the IDs exists or
+ * if one of the IDs is the ID of the RUNNING thread.
+ * Return value: On success, return the ID of the terminated thread.
+ * On failure, return -1.
+*/
+int uthread_join_any(const int *tids, int n);
+
+
+/*
+ * Description: This function splits the range [begin, end) into chunks of at
+ * most grain elements, calls fn(chunkBegin, chunkEnd) for every chunk in a
+ * new thread and blocks the RUNNING thread until all the chunks are done.
+ * When the number of threads reaches MAX_THREAD_NUM the RUNNING thread runs
+ * the next chunk by itself. It is an error to call this function with
+ * begin > end, a non-positive grain or a null fn.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_parallel_for(int begin, int end, int grain, void (*fn)(int begin, int end));
+
+
+/*
+ * Description: This function creates a new thread-local storage key. Every
+ * thread has its own value for the key, which is null until the thread sets
+ * it. When a thread is terminated and its value for the key is not null, the
+ * destructor (if not null) is called with the value. Destructors run while
+ * the library is in the middle of uthread_terminate, so they must not call
+ * functions of the thread library. It is an error to call this function if
+ * it would cause the number of keys to exceed MAX_KEY_NUM.
+ * Return value: On success, return the created key. On failure, return -1.
+*/
+int uthread_key_create(void (*destructor)(void *));
+
+
+/*
+ * Description: This function deletes the thread-local storage key. The
+ * values of the key are cleared in all the threads without calling the
+ * destructor. If no key with this value exists it is considered an error.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_key_delete(int key);
+
+
+/*
+ * Description: This function returns the value of the key for the calling
+ * thread. It takes constant time. If no key with this value exists it is
+ * considered an error.
+ * Return value: On success, return the value of the key (null if it was not
+ * set by the calling thread). On failure, return null.
+*/
+void *uthread_getspecific(int key);
+
+
+/*
+ * Description: This function sets the value of the key for the calling
+ * thread. It takes constant time. If no key with this value exists it is
+ * considered an error.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_setspecific(int key, const void *value);
+
+
+/*
+ * Description: This function resumes the thread with ID tid like
+ * uthread_resume, but unlike all the other functions of the library it may
+ * be called from any kernel thread (pthread) of the process, e.g. a logging
+ * thread or a callback thread of another library, and from a signal handler.
+ * It is the only way for a signal handler to wake a thread: the library
+ * blocks only its own signals, so a handler of another signal may interrupt
+ * it halfway, and must not call any of its other functions (except
+ * uthread_post). It never takes a lock or changes a signal mask: the request is pushed to a lock-free inbox of
+ * INBOX_SIZE messages and the scheduler handles it at its next scheduling
+ * decision, waking up for it if no thread is ready. If no thread with ID tid
+ * exists when the request is handled, the error is reported then. It is an
+ * error to call this function with a tid which is not in the range
+ * [0, MAX_THREAD_NUM), or when the inbox is full.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_resume_external(int tid);
+
+
+/*
+ * Description: This function makes the scheduler call fn(arg) at its next
+ * scheduling decision. Like uthread_resume_external it may be called from
+ * any kernel thread of the process and from a signal handler. fn runs on the kernel thread of the
+ * library while the library is in the middle of a scheduling decision, so it
+ * must not call functions of the thread library other than
+ * uthread_resume_external and uthread_post. It is an error to call this
+ * function with a null fn, or when the inbox is full.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_post(void (*fn)(void *), void *arg);
+
+
+/*
+ * Description: This function initializes the thread library like
+ * uthread_init, but in deterministic mode: no timer signal preempts the
+ * threads, and instead a virtual clock is advanced by uthread_tick. The
+ * budget of every quantum is quantum_ticks ticks if seed is 0, and otherwise
+ * a pseudo random number of ticks in [1, quantum_ticks] drawn from seed, so
+ * the same seed always gives the same preemption schedule. The budgets are
+ * recorded and can be saved and replayed with uthread_schedule_save and
+ * uthread_schedule_load. Either this function or uthread_init is called,
+ * exactly once. It is an error to call this function with non-positive
+ * quantum_ticks.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_init_deterministic(int quantum_ticks, unsigned int seed);
+
+
+/*
+ * Description: This function advances the virtual clock by ticks: it is an
+ * explicit preemption point, and ticks is the amount of work done since the
+ * previous one (e.g. 1 per loop iteration). When the budget of the current
+ * quantum runs out, the RUNNING thread is preempted as if its quantum had
+ * expired. Without deterministic mode the function does nothing, so
+ * instrumented code runs in both modes. It is an error to call this function
+ * with non-positive ticks.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_tick(int ticks);
+
+
+/*
+ * Description: This function returns the number of ticks of the virtual
+ * clock since the library was initialized in deterministic mode.
+ * Return value: The virtual time in ticks.
+*/
+long long uthread_get_virtual_time();
+
+
+/*
+ * Description: This function writes the budgets of all the quantums so far,
+ * one number of ticks per line, to the file descriptor fd. It is an error to
+ * call this function without deterministic mode or if the write fails.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_schedule_save(int fd);
+
+
+/*
+ * Description: This function reads budgets written by uthread_schedule_save
+ * from the file descriptor fd, and the following quantums use them in order
+ * instead of drawing new budgets (after the last one, budgets are drawn
+ * again). Called right after uthread_init_deterministic, it replays the
+ * recorded schedule exactly. It is an error to call this function without
+ * deterministic mode, if the read fails or if the file has a budget which is
+ * not a positive number.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_schedule_load(int fd);
+
+
+/*
+ * Description: This function starts the sampling profiler. Every
+ * sample_usecs micro-seconds of CPU time of the library (by a timer of its
+ * own, also in tickless and deterministic modes), the ID of the RUNNING
+ * thread and a frame pointer backtrace of up to PROFILE_MAX_DEPTH frames are
+ * recorded in a buffer of PROFILE_MAX_SAMPLES samples, which is allocated
+ * here. When the buffer is full, further samples are dropped. Backtraces
+ * need code compiled with -fno-omit-frame-pointer, and function names need
+ * exported symbols (e.g. linking with -rdynamic). Time spent inside the
+ * library is sampled when the library returns to the thread. It is an error
+ * to call this function with non-positive sample_usecs or while the profiler
+ * runs.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_profile_start(int sample_usecs);
+
+
+/*
+ * Description: This function stops the sampling profiler and writes the
+ * samples to the file descriptor fd as folded stacks, ready for flame graph
+ * tools and split by thread: every line is
+ * "uthread-<tid>;<root frame>;...;<leaf frame> <number of samples>".
+ * Frames without a known symbol are written as <module>+0x<offset>. The
+ * samples are folded on a temporary stack of the library, so any thread may
+ * call this function. It is an error to call this function when the profiler
+ * doesn't run or if the write fails.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_profile_stop(int fd);
+
 #endif
 